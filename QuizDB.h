@@ -1,104 +1,287 @@
 #ifndef _QUIZDB_H
 #define _QUIZDB_H
 
+#include <stddef.h>
+
 /*************************************
- *         Quiz Questions            *
+ *      Quiz Questions and Answers   *
  *************************************/
 
-char* QuizQ[] = {
-"In a 32-bit system architecture, each process can address 4 Giga bytes of memory. Y or N?",
-"Is Stack a section of a process's address space? (Y or N)",
-"Is Heap a section of a process's address space? (Y or N)",
-"Is Environment a section of a process's address space? (Y or N)",
-"What is the program that allows users to run programs with security privileges of another user? (Hint: Answer is a 4-letter word.)",
-"chown is a user command to change file mode bits. Y or N?",
-"chmod is a user command to change file owner and group. Y or N?",
-"What is the standard C library function to open a file?",
-"What is the standard C library function to close a file?",
-"A global variable in a C program is visible to all functions. Y or N?",
-"What does the malloc() library function return on failure? (Hint: A four-letter word)",
-"What does the calloc() library function return on failure? (Hint: A four-letter word)",
-"Does the free() library function return a value? (Y or N)?",
-"The size of int* in 64-bit system architecture is 4 bytes. (Y or N)?",
-"The size of int* in 64-bit system architecture is 8 bytes. (Y or N)?",
-"Is malloc() a system call? (Y or N)",
-"Is malloc() a C library function? (Y or N)",
-"Is fork() a system call? (Y or N)",
-"In compilation, what converts assembly code into machine code? (Hint: a 8-letter word.)",
-"Is preprocessing a phase of compilation? (Y or N)",
-"Is linking a phase of compilation? (Y or N)",
-"A static library is an archive of object files. Y or N?",
-"A shared library is included in an executable. Y or N?",
-"A pthread is a light-weight process. Y or N?",
-"In a process, two pointers having the same value point to the same data. Y or N?",
-"What is the system call that returns two completely independent copies of the original process? (Hint: A four-letter word)",
-"All the threads inside a process have access to the same global, shared memory. Y or N?",
-"What is the software interrupt sent to a program to indicate that an important event has happened? (Hint: a six-letter word)",
-"What integer represents SIGINT?",
-"What integer represents SIGTERM?",
-"What integer represents SIGSEGV?",
-"What integer represents SIGCHLD?",
-"ssh is used for secure data communication between two networked computers. Y or N?",
-"An IPv4 address consists of four bytes. Y or N?",
-"An IPv6 address consists of eight bytes. Y or N?",
-"What is the interprocess communication (IPC) mechanism that allows data to be exchanged between applications on different hosts connected by a network? (Hint: a six-letter word.)",
-"A socket is a file. Y or N?",
-"Stream sockets provide a reliable, bidirectional, byte-stream communication channel. Y or N?",
-"Datagram sockets provide a reliable communication channel. Y or N?",
-"Datagram sockets are connectionless sockets. Y or N?",
-"Stream sockets are connectionless sockets. Y or N?",
-"Stream sockets are connection-oriented sockets. Y or N?",
-"127.0.0.1 is called a loopback IP address. Y or N?"
+/*
+ * quiz_var: One value a question template can be filled with, and the answer that value calls for.
+ */
+struct quiz_var {
+    const char* text;
+    unsigned short len;
+    const char* answer;
+    unsigned short answer_len;
 };
 
-/*************************************
- *         Quiz Answers              *
- *************************************/
+#define QUIZ_VAR(text, answer) { text, sizeof(text) - 1, answer, sizeof(answer) - 1 }
+
+static const struct quiz_var QuizSignalNumbers[] = {
+    QUIZ_VAR("SIGHUP", "1"), QUIZ_VAR("SIGINT", "2"), QUIZ_VAR("SIGQUIT", "3"),
+    QUIZ_VAR("SIGKILL", "9"), QUIZ_VAR("SIGSEGV", "11"), QUIZ_VAR("SIGPIPE", "13"),
+    QUIZ_VAR("SIGALRM", "14"), QUIZ_VAR("SIGTERM", "15"), QUIZ_VAR("SIGCHLD", "17")
+};
+
+static const struct quiz_var QuizSignalNames[] = {
+    QUIZ_VAR("1", "SIGHUP"), QUIZ_VAR("2", "SIGINT"), QUIZ_VAR("3", "SIGQUIT"),
+    QUIZ_VAR("9", "SIGKILL"), QUIZ_VAR("11", "SIGSEGV"), QUIZ_VAR("13", "SIGPIPE"),
+    QUIZ_VAR("14", "SIGALRM"), QUIZ_VAR("15", "SIGTERM"), QUIZ_VAR("17", "SIGCHLD")
+};
+
+static const struct quiz_var QuizFileModes[] = {
+    QUIZ_VAR("rwxr-xr-x", "755"), QUIZ_VAR("rw-r--r--", "644"), QUIZ_VAR("rwx------", "700"),
+    QUIZ_VAR("rw-------", "600"), QUIZ_VAR("rwxr-x---", "750"), QUIZ_VAR("rw-rw-r--", "664"),
+    QUIZ_VAR("r--r--r--", "444"), QUIZ_VAR("rwxrwxrwx", "777")
+};
+
+static const struct quiz_var QuizTypeSizes[] = {
+    QUIZ_VAR("char", "1"), QUIZ_VAR("short", "2"), QUIZ_VAR("int", "4"), QUIZ_VAR("long", "8"),
+    QUIZ_VAR("float", "4"), QUIZ_VAR("double", "8"), QUIZ_VAR("void*", "8"), QUIZ_VAR("int*", "8")
+};
+
+/*
+ * Each QUIZ_ITEM pairs a question with its answer. Each QUIZ_CHOICE is a
+ * multiple-choice question with four options and the letters of the
+ * right options as its answer; several letters make it multi-select.
+ * Each QUIZ_TEMPLATE is a question whose middle is filled in per quiz
+ * from a table of quiz_var values, each carrying its own answer.
+ * QUIZ_ATTACH is a QUIZ_ITEM that comes with a file (a listing or a
+ * diagram) sent to the client before the question.
+ * The tables below are all generated from this one list at compile
+ * time, so the question and answer tables cannot get out of step, and
+ * the protocol frames sent to clients are string literals placed in
+ * read-only memory.
+ */
+#define QUIZ_ITEMS \
+QUIZ_ITEM("In a 32-bit system architecture, each process can address 4 Giga bytes of memory. Y or N?", \
+          "Y") \
+QUIZ_ITEM("Is Stack a section of a process's address space? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("Is Heap a section of a process's address space? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("Is Environment a section of a process's address space? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("What is the program that allows users to run programs with security privileges of another user? (Hint: Answer is a 4-letter word.)", \
+          "sudo") \
+QUIZ_ITEM("chown is a user command to change file mode bits. Y or N?", \
+          "N") \
+QUIZ_ITEM("chmod is a user command to change file owner and group. Y or N?", \
+          "N") \
+QUIZ_ITEM("What is the standard C library function to open a file?", \
+          "fopen") \
+QUIZ_ITEM("What is the standard C library function to close a file?", \
+          "fclose") \
+QUIZ_ITEM("A global variable in a C program is visible to all functions. Y or N?", \
+          "Y") \
+QUIZ_ITEM("What does the malloc() library function return on failure? (Hint: A four-letter word)", \
+          "NULL") \
+QUIZ_ITEM("What does the calloc() library function return on failure? (Hint: A four-letter word)", \
+          "NULL") \
+QUIZ_ITEM("Does the free() library function return a value? (Y or N)?", \
+          "N") \
+QUIZ_ITEM("The size of int* in 64-bit system architecture is 4 bytes. (Y or N)?", \
+          "N") \
+QUIZ_ITEM("The size of int* in 64-bit system architecture is 8 bytes. (Y or N)?", \
+          "Y") \
+QUIZ_ITEM("Is malloc() a system call? (Y or N)", \
+          "N") \
+QUIZ_ITEM("Is malloc() a C library function? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("Is fork() a system call? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("In compilation, what converts assembly code into machine code? (Hint: a 8-letter word.)", \
+          "assembler") \
+QUIZ_ITEM("Is preprocessing a phase of compilation? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("Is linking a phase of compilation? (Y or N)", \
+          "Y") \
+QUIZ_ITEM("A static library is an archive of object files. Y or N?", \
+          "Y") \
+QUIZ_ITEM("A shared library is included in an executable. Y or N?", \
+          "N") \
+QUIZ_ITEM("A pthread is a light-weight process. Y or N?", \
+          "Y") \
+QUIZ_ITEM("In a process, two pointers having the same value point to the same data. Y or N?", \
+          "Y") \
+QUIZ_ITEM("What is the system call that returns two completely independent copies of the original process? (Hint: A four-letter word)", \
+          "fork") \
+QUIZ_ITEM("All the threads inside a process have access to the same global, shared memory. Y or N?", \
+          "Y") \
+QUIZ_ITEM("What is the software interrupt sent to a program to indicate that an important event has happened? (Hint: a six-letter word)", \
+          "signal") \
+QUIZ_TEMPLATE("What integer represents ", "?", \
+              QuizSignalNumbers) \
+QUIZ_TEMPLATE("Which signal has the number ", "? (Hint: for example SIGHUP)", \
+              QuizSignalNames) \
+QUIZ_TEMPLATE("What octal mode gives the permissions ", "? (Hint: for example 644)", \
+              QuizFileModes) \
+QUIZ_TEMPLATE("How many bytes does sizeof(", ") give on 64-bit Linux?", \
+              QuizTypeSizes) \
+QUIZ_ITEM("ssh is used for secure data communication between two networked computers. Y or N?", \
+          "Y") \
+QUIZ_ITEM("An IPv4 address consists of four bytes. Y or N?", \
+          "Y") \
+QUIZ_ITEM("An IPv6 address consists of eight bytes. Y or N?", \
+          "N") \
+QUIZ_ITEM("What is the interprocess communication (IPC) mechanism that allows data to be exchanged between applications on different hosts connected by a network? (Hint: a six-letter word.)", \
+          "socket") \
+QUIZ_ITEM("A socket is a file. Y or N?", \
+          "Y") \
+QUIZ_ITEM("Stream sockets provide a reliable, bidirectional, byte-stream communication channel. Y or N?", \
+          "Y") \
+QUIZ_ITEM("Datagram sockets provide a reliable communication channel. Y or N?", \
+          "N") \
+QUIZ_ITEM("Datagram sockets are connectionless sockets. Y or N?", \
+          "Y") \
+QUIZ_ITEM("Stream sockets are connectionless sockets. Y or N?", \
+          "N") \
+QUIZ_ITEM("Stream sockets are connection-oriented sockets. Y or N?", \
+          "Y") \
+QUIZ_ITEM("127.0.0.1 is called a loopback IP address. Y or N?", \
+          "Y") \
+QUIZ_CHOICE("Which system call replaces the current process image? (choose one)", \
+            "fork()", "exec()", "wait()", "pipe()", "B") \
+QUIZ_CHOICE("Which of these are system calls? (choose all that apply)", \
+            "read()", "printf()", "open()", "malloc()", "AC") \
+QUIZ_CHOICE("Which signal cannot be caught or ignored? (choose one)", \
+            "SIGTERM", "SIGINT", "SIGKILL", "SIGHUP", "C") \
+QUIZ_CHOICE("Which calls does a TCP server make before accept()? (choose all that apply)", \
+            "socket()", "connect()", "bind()", "listen()", "ACD") \
+QUIZ_ATTACH("How many times does the attached program print hello? (Hint: a number)", \
+            "4", "attachments/fork_hello.c") \
+/* end of QUIZ_ITEMS */
+
+/* Apart from the attachment table, an attachment question is a plain question */
+#define QUIZ_ATTACH(q, a, path) QUIZ_ITEM(q, a)
 
-char* QuizA[] = {
-"Y",
-"Y",
-"Y",
-"Y",
-"sudo",
-"N",
-"N",
-"fopen",
-"fclose",
-"Y",
-"NULL",
-"NULL",
-"N",
-"N",
-"Y",
-"N",
-"Y",
-"Y",
-"assembler",
-"Y",
-"Y",
-"Y",
-"N",
-"Y",
-"Y",
-"fork",
-"Y",
-"signal",
-"2",
-"15",
-"11",
-"17",
-"Y",
-"Y",
-"N",
-"socket",
-"Y",
-"Y",
-"N",
-"Y",
-"N",
-"Y",
-"Y"
+/* Number of questions */
+#define QUIZ_ITEM(q, a) + 1
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) + 1
+#define QUIZ_TEMPLATE(pre, post, vars) + 1
+enum { QuizCount = 0 QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Question texts */
+#define QUIZ_ITEM(q, a) q,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) q,
+#define QUIZ_TEMPLATE(pre, post, vars) pre "..." post,
+static const char* const QuizQ[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Answer texts */
+#define QUIZ_ITEM(q, a) a,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) a,
+#define QUIZ_TEMPLATE(pre, post, vars) "(depends on the question)",
+static const char* const QuizA[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Question frames: the question line exactly as sent to the client; multiple-choice lines are assembled per session */
+#define QUIZ_ITEM(q, a) q "\n",
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) NULL,
+#define QUIZ_TEMPLATE(pre, post, vars) NULL,
+static const char* const QuizQFrame[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+#define QUIZ_ITEM(q, a) sizeof(q "\n") - 1,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) 0,
+#define QUIZ_TEMPLATE(pre, post, vars) 0,
+static const unsigned short QuizQFrameLen[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Feedback frames sent after a wrong answer; multiple-choice letters depend on the session's shuffle */
+#define QUIZ_ITEM(q, a) "Wrong Answer. Right answer is " a ".\n",
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) NULL,
+#define QUIZ_TEMPLATE(pre, post, vars) NULL,
+static const char* const QuizWrongFrame[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+#define QUIZ_ITEM(q, a) sizeof("Wrong Answer. Right answer is " a ".\n") - 1,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) 0,
+#define QUIZ_TEMPLATE(pre, post, vars) 0,
+static const unsigned short QuizWrongFrameLen[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Options of multiple-choice questions in their original order; NULL for free-text questions */
+#define QUIZ_ITEM(q, a) { NULL, NULL, NULL, NULL },
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) { o1, o2, o3, o4 },
+#define QUIZ_TEMPLATE(pre, post, vars) { NULL, NULL, NULL, NULL },
+static const char* const QuizOpt[][4] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+#define QUIZ_ITEM(q, a) { 0, 0, 0, 0 },
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) { sizeof(o1) - 1, sizeof(o2) - 1, sizeof(o3) - 1, sizeof(o4) - 1 },
+#define QUIZ_TEMPLATE(pre, post, vars) { 0, 0, 0, 0 },
+static const unsigned short QuizOptLen[][4] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Bit i of the mask is set when option i (A = 0) is right; the letters are decoded at compile time */
+#define QUIZ_LETTER_BIT(a, i) (sizeof(a) > (i) + 1 ? 1u << ((a)[sizeof(a) > (i) + 1 ? (i) : 0] - 'A') : 0u)
+#define QUIZ_ITEM(q, a) 0,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) QUIZ_LETTER_BIT(a, 0) | QUIZ_LETTER_BIT(a, 1) | QUIZ_LETTER_BIT(a, 2) | QUIZ_LETTER_BIT(a, 3),
+#define QUIZ_TEMPLATE(pre, post, vars) 0,
+static const unsigned char QuizMask[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Question templates: the text around the variable, and the values it can take */
+struct quiz_template {
+    const char* prefix;
+    unsigned short prefix_len;
+    const char* suffix;
+    unsigned short suffix_len;
+    const struct quiz_var* vars;
+    unsigned short num_vars;
 };
 
+#define QUIZ_ITEM(q, a) { NULL, 0, NULL, 0, NULL, 0 },
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) { NULL, 0, NULL, 0, NULL, 0 },
+#define QUIZ_TEMPLATE(pre, post, vars) { pre, sizeof(pre) - 1, post, sizeof(post) - 1, vars, sizeof(vars) / sizeof(vars[0]) },
+static const struct quiz_template QuizTemplate[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+
+/* Attachment file of each question, NULL if it has none */
+#undef QUIZ_ATTACH
+#define QUIZ_ITEM(q, a) NULL,
+#define QUIZ_CHOICE(q, o1, o2, o3, o4, a) NULL,
+#define QUIZ_TEMPLATE(pre, post, vars) NULL,
+#define QUIZ_ATTACH(q, a, path) path,
+static const char* const QuizAttach[] = { QUIZ_ITEMS };
+#undef QUIZ_ITEM
+#undef QUIZ_CHOICE
+#undef QUIZ_TEMPLATE
+#undef QUIZ_ATTACH
+
+_Static_assert(sizeof(QuizQ) / sizeof(QuizQ[0]) == QuizCount, "QuizQ does not match QUIZ_ITEMS");
+_Static_assert(sizeof(QuizA) / sizeof(QuizA[0]) == QuizCount, "QuizA does not match QuizQ");
+_Static_assert(sizeof(QuizQFrameLen) / sizeof(QuizQFrameLen[0]) == QuizCount, "QuizQFrameLen does not match QuizQ");
+_Static_assert(sizeof(QuizWrongFrameLen) / sizeof(QuizWrongFrameLen[0]) == QuizCount, "QuizWrongFrameLen does not match QuizQ");
+_Static_assert(sizeof(QuizOpt) / sizeof(QuizOpt[0]) == QuizCount, "QuizOpt does not match QuizQ");
+_Static_assert(sizeof(QuizMask) / sizeof(QuizMask[0]) == QuizCount, "QuizMask does not match QuizQ");
+_Static_assert(sizeof(QuizTemplate) / sizeof(QuizTemplate[0]) == QuizCount, "QuizTemplate does not match QuizQ");
+_Static_assert(sizeof(QuizAttach) / sizeof(QuizAttach[0]) == QuizCount, "QuizAttach does not match QuizQ");
+
 #endif /* _QUIZDB_H */
@@ -0,0 +1,176 @@
+#ifndef _QUIZDUP_H
+#define _QUIZDUP_H
+
+/*
+ * [QuizDup.h]
+ *
+ * Near-duplicate detection for the quiz bank. Question texts are split
+ * into word-pair shingles, each text is summarised by a MinHash
+ * signature, and locality-sensitive hashing over bands of the
+ * signature pairs up likely near-duplicates without comparing every
+ * question with every other. Candidate pairs whose estimated
+ * similarity reaches DUP_THRESHOLD are merged into groups.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define DUP_HASHES 32
+#define DUP_BANDS 8
+#define DUP_ROWS (DUP_HASHES / DUP_BANDS)
+#define DUP_THRESHOLD 0.5
+
+/*
+ * dup_mix: Finalises a 64-bit hash (the splitmix64 mixing function).
+ */
+static inline uint64_t dup_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/*
+ * dup_next_word: Hashes the next word of a text, ignoring case and punctuation.
+ * Returns 0 at the end of the text, otherwise the (non-zero) word hash, and advances *text past the word.
+ */
+static inline uint64_t dup_next_word(const char** text) {
+    const char* p = *text;
+    while (*p && !isalnum((unsigned char)*p)) p++;
+    if (*p == '\0') {
+        *text = p;
+        return 0;
+    }
+    uint64_t h = 0xCBF29CE484222325ULL;
+    while (*p && isalnum((unsigned char)*p)) {
+        h ^= (unsigned char)tolower((unsigned char)*p);
+        h *= 0x100000001B3ULL;
+        p++;
+    }
+    *text = p;
+    return h | 1;
+}
+
+/*
+ * dup_signature: Computes the MinHash signature of a text over its word-pair shingles.
+ * The inner loop applies all DUP_HASHES hash functions to one shingle with no data-dependent branches, so the compiler can vectorise it.
+ */
+static inline void dup_signature(const char* text, uint64_t sig[DUP_HASHES]) {
+    for (int k = 0; k < DUP_HASHES; k++) {
+        sig[k] = UINT64_MAX;
+    }
+    uint64_t prev = dup_next_word(&text);
+    uint64_t word;
+    while ((word = dup_next_word(&text)) != 0) {
+        uint64_t shingle = dup_mix(prev * 31 + word);
+        for (int k = 0; k < DUP_HASHES; k++) {
+            uint64_t h = dup_mix(shingle + 0x9E3779B97F4A7C15ULL * (uint64_t)(k + 1));
+            sig[k] = h < sig[k] ? h : sig[k];
+        }
+        prev = word;
+    }
+}
+
+/*
+ * dup_similarity: Estimates the Jaccard similarity of two texts from their signatures.
+ */
+static inline double dup_similarity(const uint64_t* a, const uint64_t* b) {
+    int same = 0;
+    for (int k = 0; k < DUP_HASHES; k++) {
+        same += a[k] == b[k];
+    }
+    return (double)same / DUP_HASHES;
+}
+
+/*
+ * dup_find: Returns the group representative of an item, compressing the path on the way.
+ */
+static inline int dup_find(int* groups, int i) {
+    while (groups[i] != i) {
+        groups[i] = groups[groups[i]];
+        i = groups[i];
+    }
+    return i;
+}
+
+/* Band key of one item, sorted so equal keys end up next to each other */
+struct dup_bucket {
+    uint64_t key;
+    int item;
+};
+
+static inline int dup_bucket_cmp(const void* a, const void* b) {
+    const struct dup_bucket* x = a;
+    const struct dup_bucket* y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->item - y->item;
+}
+
+/*
+ * dup_groups: Groups near-duplicate texts.
+ * On return groups[i] holds the lowest index of the group item i belongs to, so items that are not near-duplicates of anything are their own group. Each band is bucketed by sorting, making the whole pass O(n log n) rather than comparing all pairs. Returns the number of items that belong to a group of two or more, or -1 if memory runs out.
+ */
+static inline int dup_groups(const char* const* texts, int n, int* groups) {
+    uint64_t* sigs = malloc(sizeof(uint64_t) * DUP_HASHES * (n > 0 ? n : 1));
+    struct dup_bucket* buckets = malloc(sizeof(struct dup_bucket) * (n > 0 ? n : 1));
+    if (sigs == NULL || buckets == NULL) {
+        free(sigs);
+        free(buckets);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        dup_signature(texts[i], &sigs[i * DUP_HASHES]);
+        groups[i] = i;
+    }
+
+    for (int band = 0; band < DUP_BANDS; band++) {
+        /* Hash this band of every signature into a bucket key */
+        for (int i = 0; i < n; i++) {
+            uint64_t key = 0;
+            for (int r = 0; r < DUP_ROWS; r++) {
+                key = dup_mix(key ^ sigs[i * DUP_HASHES + band * DUP_ROWS + r]);
+            }
+            buckets[i].key = key;
+            buckets[i].item = i;
+        }
+        qsort(buckets, n, sizeof(buckets[0]), dup_bucket_cmp);
+
+        /* Verify and merge candidates sharing a bucket */
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n && buckets[j].key == buckets[i].key; j++) {
+                int a = buckets[i].item;
+                int b = buckets[j].item;
+                if (dup_similarity(&sigs[a * DUP_HASHES], &sigs[b * DUP_HASHES]) < DUP_THRESHOLD) continue;
+                int ra = dup_find(groups, a);
+                int rb = dup_find(groups, b);
+                /* Keep the lowest index as the representative */
+                if (ra < rb) groups[rb] = ra;
+                else if (rb < ra) groups[ra] = rb;
+            }
+        }
+    }
+
+    /* Count group sizes, reusing the bucket array as counters */
+    int grouped = 0;
+    for (int i = 0; i < n; i++) {
+        groups[i] = dup_find(groups, i);
+        buckets[i].item = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        buckets[groups[i]].item++;
+    }
+    for (int i = 0; i < n; i++) {
+        if (buckets[groups[i]].item > 1) grouped++;
+    }
+
+    free(sigs);
+    free(buckets);
+    return grouped;
+}
+
+#endif /* _QUIZDUP_H */
@@ -0,0 +1,290 @@
+#ifndef _QUIZINDEX_H
+#define _QUIZINDEX_H
+
+/*
+ * [QuizIndex.h]
+ *
+ * Inverted index for full-text search over the quiz bank. Every word
+ * of every question maps to a posting list of the questions that
+ * contain it. Posting lists store the gaps between ascending question
+ * numbers as variable-length bytes, so common words cost about one
+ * byte per question. Queries are a list of words that must all occur,
+ * optionally with "-word" to exclude questions and "quoted phrases"
+ * that must occur in order.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "QuizDup.h"
+
+#define INDEX_MAX_TERMS 32
+
+/* Dictionary entry: a word and where its posting list lives */
+struct index_term {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t count;
+};
+
+struct quiz_index {
+    struct index_term* terms;
+    int num_terms;
+    unsigned char* postings;
+    int num_docs;
+};
+
+/* Word occurrence collected while building */
+struct index_hit {
+    uint64_t hash;
+    int doc;
+};
+
+static inline int index_hit_cmp(const void* a, const void* b) {
+    const struct index_hit* x = a;
+    const struct index_hit* y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->doc - y->doc;
+}
+
+/*
+ * index_free: Releases the memory held by an index.
+ */
+static inline void index_free(struct quiz_index* index) {
+    free(index->terms);
+    free(index->postings);
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * index_build: Builds the inverted index of n texts.
+ * Words are tokenised exactly as for near-duplicate detection (case-insensitive, punctuation ignored), so "fork()" is found by the word fork. Returns 0 on success or -1 if memory runs out.
+ */
+static inline int index_build(struct quiz_index* index, const char* const* texts, int n) {
+    memset(index, 0, sizeof(*index));
+    index->num_docs = n;
+
+    /* Collect every (word, question) pair */
+    int num_hits = 0, cap = 256;
+    struct index_hit* hits = malloc(sizeof(*hits) * cap);
+    if (hits == NULL) return -1;
+    for (int doc = 0; doc < n; doc++) {
+        const char* p = texts[doc];
+        uint64_t word;
+        while ((word = dup_next_word(&p)) != 0) {
+            if (num_hits == cap) {
+                struct index_hit* grown = realloc(hits, sizeof(*hits) * cap * 2);
+                if (grown == NULL) {
+                    free(hits);
+                    return -1;
+                }
+                hits = grown;
+                cap *= 2;
+            }
+            hits[num_hits].hash = word;
+            hits[num_hits].doc = doc;
+            num_hits++;
+        }
+    }
+    qsort(hits, num_hits, sizeof(*hits), index_hit_cmp);
+
+    /* Each gap needs at most 5 bytes */
+    index->terms = malloc(sizeof(struct index_term) * (num_hits > 0 ? num_hits : 1));
+    index->postings = malloc(5 * (size_t)(num_hits > 0 ? num_hits : 1));
+    if (index->terms == NULL || index->postings == NULL) {
+        free(hits);
+        index_free(index);
+        return -1;
+    }
+
+    /* Encode one posting list per word, skipping repeats of a word within a question */
+    uint32_t size = 0;
+    for (int i = 0; i < num_hits; ) {
+        struct index_term* term = &index->terms[index->num_terms++];
+        term->hash = hits[i].hash;
+        term->offset = size;
+        term->count = 0;
+        int last = -1;
+        for (; i < num_hits && hits[i].hash == term->hash; i++) {
+            if (hits[i].doc == last) continue;
+            uint32_t gap = (uint32_t)(hits[i].doc - last);
+            while (gap >= 0x80) {
+                index->postings[size++] = (unsigned char)(gap | 0x80);
+                gap >>= 7;
+            }
+            index->postings[size++] = (unsigned char)gap;
+            last = hits[i].doc;
+            term->count++;
+        }
+    }
+    free(hits);
+    return 0;
+}
+
+/*
+ * index_lookup: Finds a word in the dictionary by binary search, or returns NULL.
+ */
+static inline const struct index_term* index_lookup(const struct quiz_index* index, uint64_t hash) {
+    int lo = 0, hi = index->num_terms - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->terms[mid].hash == hash) return &index->terms[mid];
+        if (index->terms[mid].hash < hash) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+/*
+ * index_decode: Expands a posting list into ascending question numbers and returns how many there are.
+ */
+static inline int index_decode(const struct quiz_index* index, const struct index_term* term, int* results) {
+    const unsigned char* p = index->postings + term->offset;
+    int doc = -1;
+    for (uint32_t i = 0; i < term->count; i++) {
+        uint32_t gap = 0;
+        int shift = 0;
+        do {
+            gap |= (uint32_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        doc += (int)gap;
+        results[i] = doc;
+    }
+    return (int)term->count;
+}
+
+/*
+ * index_filter: Keeps (or, with exclude set, drops) the results that appear in a word's posting list.
+ * Both lists are ascending, so this is a single merge pass. Returns the new number of results.
+ */
+static inline int index_filter(const struct quiz_index* index, const struct index_term* term, int* results, int count, int exclude) {
+    const unsigned char* p = term != NULL ? index->postings + term->offset : NULL;
+    uint32_t remaining = term != NULL ? term->count : 0;
+    int doc = -1, kept = 0;
+    for (int i = 0; i < count; i++) {
+        /* Advance the posting list up to results[i] */
+        while (remaining > 0 && doc < results[i]) {
+            uint32_t gap = 0;
+            int shift = 0;
+            do {
+                gap |= (uint32_t)(*p & 0x7F) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+            doc += (int)gap;
+            remaining--;
+        }
+        if ((doc == results[i]) != exclude) results[kept++] = results[i];
+    }
+    return kept;
+}
+
+/*
+ * index_has_phrase: Checks that the words of a phrase occur consecutively in a text.
+ */
+static inline int index_has_phrase(const char* text, const uint64_t* phrase, int len) {
+    uint64_t window[INDEX_MAX_TERMS];
+    int seen = 0;
+    uint64_t word;
+    while ((word = dup_next_word(&text)) != 0) {
+        /* Slide the last len words through window */
+        if (seen == len) {
+            memmove(window, window + 1, sizeof(window[0]) * (len - 1));
+            seen--;
+        }
+        window[seen++] = word;
+        if (seen == len && memcmp(window, phrase, sizeof(window[0]) * len) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * index_search: Answers a query, storing the matching question numbers in ascending order.
+ * Every plain or quoted word must occur and no "-word" may occur. The shortest posting list is decoded first and the others only filter it. Words in the first quoted phrase must additionally appear in order, which is checked against the texts of the remaining candidates only. A quoted phrase preceded by '-' excludes the questions containing it in order; only the first such phrase counts. Returns the number of matches (at most max).
+ */
+static inline int index_search(const struct quiz_index* index, const char* const* texts, const char* query, int* results, int max) {
+    uint64_t include[INDEX_MAX_TERMS], exclude[INDEX_MAX_TERMS], phrase[INDEX_MAX_TERMS], unwanted[INDEX_MAX_TERMS];
+    int num_include = 0, num_exclude = 0, phrase_len = 0, phrase_done = 0, unwanted_len = 0, unwanted_done = 0;
+
+    /* Split the query into required, excluded and phrase words */
+    const char* p = query;
+    int quoted = 0, negated = 0;
+    while (*p) {
+        if (*p == '-' && p[1] == '"' && !quoted) {
+            /* The phrase that follows is excluded rather than required */
+            negated = 1;
+            p++;
+            continue;
+        }
+        if (*p == '"') {
+            /* Only the first quoted phrase of each kind is checked for word order */
+            if (quoted && !negated && phrase_len > 0) phrase_done = 1;
+            if (quoted && negated && unwanted_len > 0) unwanted_done = 1;
+            if (quoted) negated = 0;
+            quoted = !quoted;
+            p++;
+            continue;
+        }
+        if (!isalnum((unsigned char)*p) && *p != '-') {
+            p++;
+            continue;
+        }
+        int negate = *p == '-' && !quoted;
+        /* Parse up to the next quote so a phrase cannot swallow the following words */
+        char word_text[64];
+        int len = 0;
+        if (*p == '-') p++;
+        while (*p && *p != '"' && *p != ' ' && len < (int)sizeof(word_text) - 1) {
+            word_text[len++] = *p++;
+        }
+        word_text[len] = '\0';
+        const char* w = word_text;
+        uint64_t word;
+        while ((word = dup_next_word(&w)) != 0) {
+            if (negate) {
+                if (num_exclude < INDEX_MAX_TERMS) exclude[num_exclude++] = word;
+            } else if (negated) {
+                if (!unwanted_done && unwanted_len < INDEX_MAX_TERMS) unwanted[unwanted_len++] = word;
+            } else {
+                if (num_include < INDEX_MAX_TERMS) include[num_include++] = word;
+                if (quoted && !phrase_done && phrase_len < INDEX_MAX_TERMS) phrase[phrase_len++] = word;
+            }
+        }
+    }
+    /* A one-word excluded phrase is just an excluded word */
+    if (unwanted_len == 1 && num_exclude < INDEX_MAX_TERMS) {
+        exclude[num_exclude++] = unwanted[0];
+        unwanted_len = 0;
+    }
+    if (num_include == 0) return 0;
+
+    /* Start from the shortest required posting list */
+    const struct index_term* shortest = NULL;
+    for (int i = 0; i < num_include; i++) {
+        const struct index_term* term = index_lookup(index, include[i]);
+        if (term == NULL) return 0;
+        if (shortest == NULL || term->count < shortest->count) shortest = term;
+    }
+    int* all = malloc(sizeof(int) * shortest->count);
+    if (all == NULL) return 0;
+    int count = index_decode(index, shortest, all);
+    for (int i = 0; i < num_include && count > 0; i++) {
+        if (include[i] == shortest->hash) continue;
+        count = index_filter(index, index_lookup(index, include[i]), all, count, 0);
+    }
+    for (int i = 0; i < num_exclude && count > 0; i++) {
+        count = index_filter(index, index_lookup(index, exclude[i]), all, count, 1);
+    }
+
+    int found = 0;
+    for (int i = 0; i < count && found < max; i++) {
+        if (phrase_len > 1 && !index_has_phrase(texts[all[i]], phrase, phrase_len)) continue;
+        if (unwanted_len > 1 && index_has_phrase(texts[all[i]], unwanted, unwanted_len)) continue;
+        results[found++] = all[i];
+    }
+    free(all);
+    return found;
+}
+
+#endif /* _QUIZINDEX_H */
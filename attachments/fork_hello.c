@@ -0,0 +1,10 @@
+#include <stdio.h>
+#include <unistd.h>
+
+int main(void)
+{
+    fork();
+    fork();
+    printf("hello\n");
+    return 0;
+}
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -53,13 +54,51 @@ int read_line(int sock, char* buffer, int max_len) {
 
 /*
  * send_message: Sends a message to the socket followed by a newline.
- * This function transmits a given string to the server and appends a newline character to ensure proper message delimitation. It is used to send user responses, such as 'Y', 'q', or quiz answers, maintaining the expected communication format with the server.
+ * This function transmits a given string to the server and appends a newline character to ensure proper message delimitation. It is used to send user responses, such as 'Y', 'q', or quiz answers, maintaining the expected communication format with the server. Message and newline are gathered into one send so Nagle's algorithm cannot delay the newline.
  */
 void send_message(int sock, const char* message) {
-    /* Send the message content */
-    send(sock, message, strlen(message), 0);
-    /* Append newline to delimit message */
-    send(sock, "\n", 1, 0);
+    /* Send the message content with a newline to delimit it */
+    struct iovec parts[2] = {
+        { (void*)message, strlen(message) },
+        { "\n", 1 }
+    };
+    writev(sock, parts, 2);
+}
+
+/*
+ * receive_attachment: Saves a file the server sends ahead of a question.
+ * The header line has the form "ATTACH <name> <size>" and is followed by exactly <size> bytes, which are written to <name> in the current directory. Any directory part of the name is ignored so the server cannot write elsewhere, and an existing file is never overwritten, so the server cannot replace the user's files either. Returns 0 on success or -1 on error.
+ */
+int receive_attachment(int sock, const char* header) {
+    char name[MAX_LINES];
+    long long size;
+    if (sscanf(header, "ATTACH %255s %lld", name, &size) != 2 || size < 0) return -1;
+    const char* base = strrchr(name, '/');
+    base = base != NULL ? base + 1 : name;
+    if (base[0] == '\0' || base[0] == '.') return -1;
+
+    /* "x" opens with O_EXCL, failing if the file exists */
+    FILE* fp = fopen(base, "wbx");
+    if (fp == NULL) {
+        perror(base);
+    }
+    /* Receive the whole attachment even if it cannot be saved, to stay in step with the server */
+    char buffer[4096];
+    long long remaining = size;
+    while (remaining > 0) {
+        int n = recv(sock, buffer, remaining < (long long)sizeof(buffer) ? (int)remaining : (int)sizeof(buffer), 0);
+        if (n <= 0) {
+            if (fp != NULL) fclose(fp);
+            return -1;
+        }
+        if (fp != NULL) fwrite(buffer, 1, n, fp);
+        remaining -= n;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+        printf("[Attachment saved as %s (%lld bytes)]\n", base, size);
+    }
+    return 0;
 }
 
 /*
@@ -68,12 +107,20 @@ void send_message(int sock, const char* message) {
  */
 int main(int argc, char** argv) {
     /* Check for correct number of arguments */
-    if (argc != 3) {
-        fprintf(stderr, "Error - Incorrect number of arguments. Use as follows: %s <server IP> <server port>\n", argv[0]);
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "Error - Incorrect number of arguments. Use as follows: %s <server IP> <server port> [user name [exam|practice]]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     char* server_ip = argv[1];
+    /* Optional user name lets the server avoid repeating recent questions */
+    char* user = argc >= 4 ? argv[3] : NULL;
+    /* Optional priority class; the server serves exams ahead of practice when it is busy */
+    char* priority = argc == 5 ? argv[4] : NULL;
+    if (priority != NULL && strcmp(priority, "exam") != 0 && strcmp(priority, "practice") != 0) {
+        fprintf(stderr, "Invalid class %s, use exam or practice\n", priority);
+        exit(EXIT_FAILURE);
+    }
     /* Convert port string to integer */
     int server_port = atoi(argv[2]);
     int sock;
@@ -116,7 +163,7 @@ int main(int argc, char** argv) {
 
     /* Read user response to start or quit */
     char response[MAX_LINES];
-    printf("Enter Y to start or q to quit: ");
+    printf(user != NULL ? "Enter Y to start, R to review or q to quit: " : "Enter Y to start or q to quit: ");
     if (fgets(response, sizeof(response), stdin) == NULL) {
         /* Close socket on input error */
         close(sock);
@@ -124,8 +171,14 @@ int main(int argc, char** argv) {
     }
     /* Remove trailing newline from response */
     response[strcspn(response, "\n")] = '\0';
-    /* Send response to server */
-    send_message(sock, response);
+    /* Send response to server, identifying the user when starting the quiz */
+    if (user != NULL && (strcmp(response, "Y") == 0 || strcmp(response, "R") == 0)) {
+        char hello[2 * MAX_LINES];
+        snprintf(hello, sizeof(hello), priority != NULL ? "%s %s %s" : "%s %s", response, user, priority);
+        send_message(sock, hello);
+    } else {
+        send_message(sock, response);
+    }
 
     /* Exit if user chooses to quit */
     if (strcmp(response, "q") == 0) {
@@ -141,6 +194,13 @@ int main(int argc, char** argv) {
             printf("Connection lost.\n");
             break;
         }
+        /* Save any attachment, then read the question that follows it */
+        if (strncmp(question, "ATTACH ", 7) == 0) {
+            if (receive_attachment(sock, question) < 0 || read_line(sock, question, sizeof(question)) <= 0) {
+                printf("Connection lost.\n");
+                break;
+            }
+        }
         printf("Q: %s\n", question);
 
         /* Read user answer */
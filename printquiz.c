@@ -1,13 +1,77 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "QuizDB.h"
+#include "QuizDup.h"
+#include "QuizIndex.h"
 
 int main(int argc, char** argv)
 {
-    int q, numq = sizeof(QuizQ)/sizeof(QuizQ[0]);
+    int q, numq = QuizCount;
+
+    /* With -d, report groups of near-duplicate questions instead */
+    if (argc == 2 && strcmp(argv[1], "-d") == 0)
+    {
+        int groups[QuizCount];
+        int grouped = dup_groups(QuizQ, numq, groups);
+        if (grouped < 0)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("%d of %d questions have near-duplicates.\n", grouped, numq);
+        for (q = 0; q < numq; q++)
+        {
+            int other, first = 1;
+            if (groups[q] != q)
+                continue;
+            for (other = q + 1; other < numq; other++)
+            {
+                if (groups[other] != q)
+                    continue;
+                if (first)
+                    printf("\nQ%d. %s\n", q, QuizQ[q]);
+                printf("Q%d. %s\n", other, QuizQ[other]);
+                first = 0;
+            }
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    /* With -s, print only the questions matching a search query */
+    if (argc == 3 && strcmp(argv[1], "-s") == 0)
+    {
+        struct quiz_index index;
+        int results[QuizCount];
+        int i, found;
+        if (index_build(&index, QuizQ, numq) < 0)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        found = index_search(&index, QuizQ, argv[2], results, numq);
+        for (i = 0; i < found; i++)
+        {
+            printf("Q%d. %s\n", results[i], QuizQ[results[i]]);
+            printf("A. %s\n", QuizA[results[i]]);
+        }
+        index_free(&index);
+        exit(found > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     for (q = 0; q < numq; q++)
     {
-        printf("Q. %s\n", QuizQ[q]);
+        int o;
+        printf("Q%d. %s\n", q, QuizQ[q]);
+        for (o = 0; o < 4 && QuizOpt[q][o] != NULL; o++)
+            printf("   %c) %s\n", 'A' + o, QuizOpt[q][o]);
+        if (QuizTemplate[q].vars != NULL)
+        {
+            /* List every value the template can take with its answer */
+            for (o = 0; o < QuizTemplate[q].num_vars; o++)
+                printf("A. %s -> %s\n", QuizTemplate[q].vars[o].text, QuizTemplate[q].vars[o].answer);
+            continue;
+        }
         printf("A. %s\n", QuizA[q]);
     }
 
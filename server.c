@@ -20,26 +20,2315 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <malloc.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <linux/errqueue.h>
 #include "QuizDB.h"
+#include "QuizDup.h"
+#include "QuizIndex.h"
 
 #define MAX_LINES 256
+#define SESSION_BUFFER 4096
+#define QUIZ_LENGTH 5
+#define PLAN_QUEUE_DEPTH 8
+#define PLAN_CANDIDATES (4 * QUIZ_LENGTH)
+#define HISTORY_SLOTS 65536
+#define HISTORY_MIN_SLOTS 1024
+#define HISTORY_MEMORY_SHARE 16
+#define PRESSURE_AVG10 10.0
+#define PRESSURE_HOLD_SEC 30
+#define PRESSURE_RATE_LIMIT 1
+#define LOAD_WINDOW_SEC 10
+#define LOAD_HIGH 0.8
+#define LOAD_LOW 0.2
+#define LOAD_LAG_MS 1000
+#define LOAD_STREAK 3
+#define LOOP_BUCKETS 21
+#define WATCHDOG_MS 200
+#define WATCHDOG_FRAMES 32
+#define OUT_PARTS 32
+#define OUT_SPILL 512
+#define OUT_CAP 65536
+#define OUT_STALL_SEC 10
+#define ZEROCOPY_MIN 16384
+#define PENDING_MAX 8
+#define PENDING_SHED 4
+#define HISTORY_BITS 448
+#define MAX_QUESTIONS 256
+#define SCHEDULE_SLOTS 4096
+#define SCHEDULE_MAGIC 0x51554953u
+#define SCHEDULE_SYNC_QUIZZES 16
+#define ANSWER_TIMEOUT_SEC 120
+#define HLL_BITS 10
+#define HLL_REGISTERS (1 << HLL_BITS)
+#define RATE_SECONDS 10
+#define DRAIN_DEADLINE_SEC 60
+#define ADMIN_MAX_CONNS 4
+#define ADMIN_BUFFER 512
+#define ADMIN_COMMAND_BUDGET 4
+#define ADMIN_SEARCH_RESULTS 20
+
+_Static_assert(QuizCount <= MAX_QUESTIONS, "QuizDB.h holds more questions than MAX_QUESTIONS");
+_Static_assert(QuizCount >= QUIZ_LENGTH, "QuizDB.h holds fewer questions than one quiz asks");
+
+/*
+ * quiz_plan: A ready-to-serve quiz, i.e. candidate question indices in the order they will be offered.
+ * A plan holds more candidates than a quiz needs so questions a returning user has already seen can be skipped without generating a new plan.
+ */
+struct quiz_plan {
+    int candidates[PLAN_CANDIDATES];
+    int count;
+};
+
+/*
+ * user_history: Blocked Bloom filter of the questions recently shown to one user.
+ * Each entry is exactly one cache line: a tag identifying the user and 448 filter bits. Every probe for a question therefore touches a single cache line.
+ */
+struct user_history {
+    uint64_t tag;
+    uint64_t bits[HISTORY_BITS / 64];
+} __attribute__((aligned(64)));
+
+/*
+ * plan_queue: Ring of precomputed quiz plans plus counters describing how well it keeps up.
+ * The server is the only producer and consumer, so head and tail need no locking. A pop that finds the ring empty is counted as a starvation and the plan is generated inline instead.
+ */
+struct plan_queue {
+    struct quiz_plan ring[PLAN_QUEUE_DEPTH];
+    unsigned int head;
+    unsigned int tail;
+    unsigned long generated;
+    unsigned long served;
+    unsigned long starved;
+};
+
+/*
+ * turn: What varies each time a question is asked: the option order of a multiple-choice question, or the value filled into a template.
+ */
+struct turn {
+    unsigned char order[4];
+    const struct quiz_var* var;
+};
+
+/*
+ * out_part: A piece of output waiting to be sent, either memory or a range of an open file.
+ * Memory parts reference the frame where it lives (the question bank, constant strings) rather than holding a copy.
+ */
+struct out_part {
+    const char* data;
+    int fd;
+    off_t offset;
+    size_t len;
+};
+
+/*
+ * out_queue: Output a client has not taken yet, kept as a ring of parts.
+ * The few pieces that live on the stack, such as the score line, are copied into the spill buffer, which is reused once the queue runs empty. bytes counts the unsent memory parts, which must stay within OUT_CAP; stalled_since is when the client last stopped taking output, or zero if it keeps up. zerocopy_pending counts MSG_ZEROCOPY sends the kernel has not yet reported complete, i.e. sends whose memory it may still read.
+ */
+struct out_queue {
+    struct out_part parts[OUT_PARTS];
+    int head;
+    int count;
+    size_t bytes;
+    int spill_len;
+    char spill[OUT_SPILL];
+    struct timespec stalled_since;
+    int zerocopy;
+    unsigned int zerocopy_pending;
+};
+
+/*
+ * session: State of one client connection.
+ * Received bytes are buffered here so lines can be split out without a system call per byte.
+ */
+struct session {
+    int sock;
+    int timed_out;
+    int input_start;
+    int input_end;
+    char input[SESSION_BUFFER];
+    struct out_queue out;
+    int evicted;
+    /* What the admin interface shows about the session */
+    unsigned long id;
+    char peer[INET_ADDRSTRLEN];
+    char user[64];
+    const char* phase;
+    int question;
+    int asked;
+    int score;
+    time_t started;
+    /* Priority class from the handshake, and when the client connected and when its handshake arrived */
+    int priority;
+    struct timespec admitted;
+    struct timespec queued;
+};
+
+/* Priority classes a client can ask for in its handshake; a higher class is served more often */
+enum session_class {
+    CLASS_PRACTICE,
+    CLASS_EXAM,
+    CLASSES
+};
+
+/*
+ * class_stats: Counters for one priority class, i.e. how many of its sessions were served or turned away, and how long the served ones waited in the queue.
+ */
+struct class_stats {
+    uint64_t served;
+    uint64_t shed;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+};
+
+/*
+ * question_stats: Counters for one question, kept in an array indexed by question number.
+ */
+struct question_stats {
+    uint64_t asked;
+    uint64_t correct;
+    uint64_t wrong;
+    uint64_t timed_out;
+    uint64_t think_ns;
+};
+
+/*
+ * hll: HyperLogLog sketch estimating the number of distinct items added, in HLL_REGISTERS bytes.
+ * Sketches merge by taking the register-wise maximum, so counts from several servers or time windows combine without double-counting.
+ */
+struct hll {
+    uint8_t registers[HLL_REGISTERS];
+};
+
+/*
+ * unique_counter: Distinct-count sketches for the current hour and day, plus the final counts of the previous ones.
+ * The day sketch holds the hours of the day that have already ended; the current hour is merged in when the day is estimated or the hour ends.
+ */
+struct unique_counter {
+    struct hll hour;
+    struct hll day;
+    uint32_t hour_id;
+    uint32_t day_id;
+    double last_hour;
+    double last_day;
+};
+
+/* Events counted over a sliding window */
+enum rate_event {
+    RATE_ACCEPTED,
+    RATE_COMPLETED,
+    RATE_CORRECT,
+    RATE_WRONG,
+    RATE_ERRORS,
+    RATE_REJECTED,
+    RATE_EVENTS
+};
+
+/*
+ * rate_window: Event counts for each of the last RATE_SECONDS seconds.
+ * Each bucket remembers which second it holds, so stale buckets are recognised and reset lazily when reused or skipped when read, and an idle server needs no timer to age them out.
+ */
+struct rate_window {
+    uint32_t second[RATE_SECONDS];
+    uint32_t count[RATE_SECONDS][RATE_EVENTS];
+};
+
+/*
+ * question_bank: The live question bank, i.e. the compiled-in questions with any patch applied on top.
+ * Unpatched entries point straight at the strings and prebuilt frames in QuizDB.h, so they are shared rather than copied; only edited and added questions point into the patch buffer, and have no prebuilt frames. Multiple-choice questions have options and a mask of the right ones, templated questions point at their template, and questions with an attachment keep its file open; patches only produce free-text questions. Question numbers never change: added questions are numbered after the compiled-in ones and retired questions keep their number but are no longer asked.
+ */
+struct question_bank {
+    const char* questions[MAX_QUESTIONS];
+    const char* answers[MAX_QUESTIONS];
+    const char* question_frames[MAX_QUESTIONS];
+    const char* wrong_frames[MAX_QUESTIONS];
+    unsigned short question_frame_len[MAX_QUESTIONS];
+    unsigned short wrong_frame_len[MAX_QUESTIONS];
+    const char* const* options[MAX_QUESTIONS];
+    const unsigned short* option_len[MAX_QUESTIONS];
+    unsigned char choice_mask[MAX_QUESTIONS];
+    const struct quiz_template* templates[MAX_QUESTIONS];
+    const char* attachment_names[MAX_QUESTIONS];
+    int attachment_fds[MAX_QUESTIONS];
+    off_t attachment_sizes[MAX_QUESTIONS];
+    unsigned char retired[MAX_QUESTIONS];
+    int count;
+    unsigned int version;
+    char* patch;
+};
+
+/*
+ * schedule_record: Spaced-repetition state of one user.
+ * For every question the record holds the time it is next due for review (0 if never asked) and the current review level, which selects the interval until the next review.
+ */
+struct schedule_record {
+    uint64_t tag;
+    uint32_t due[MAX_QUESTIONS];
+    uint8_t level[MAX_QUESTIONS];
+};
+
+/*
+ * schedule_store: Layout of the memory-mapped schedule file.
+ * The header lets the server recognise a file written with a different layout and start it afresh instead of misreading it.
+ */
+struct schedule_store {
+    uint32_t magic;
+    uint32_t slots;
+    uint32_t max_questions;
+    uint32_t record_size;
+    struct schedule_record records[SCHEDULE_SLOTS];
+};
+
+/*
+ * load_monitor: How busy the server is, measured over windows of LOAD_WINDOW_SEC, and the scaling it suggests.
+ * CPU utilisation is the share of time spent outside poll(). Occupancy is the share spent serving a session, during which other clients can only wait, and lag is the longest a client waited in the queue for that. The hint is +1 to run more instances, -1 to run fewer and 0 to stay; it changes only after LOAD_STREAK windows in a row agree, so a burst does not make it flap.
+ */
+struct load_monitor {
+    struct timespec window_start;
+    struct timespec session_mark;
+    uint64_t idle_ns;
+    uint64_t session_ns;
+    uint64_t lag_max_ns;
+    double utilization;
+    double occupancy;
+    double lag_ms;
+    int hint;
+    int pending;
+    int streak;
+    unsigned long scale_out;
+    unsigned long scale_in;
+};
+
+/*
+ * admin_conn: A connection to the admin socket with its partly received command line.
+ */
+struct admin_conn {
+    int fd;
+    int len;
+    char buffer[ADMIN_BUFFER];
+};
+
+/* Review intervals in seconds, indexed by level; a wrong answer drops back to level 1 */
+static const uint32_t review_intervals[] = {
+    0, 10 * 60, 24 * 3600, 3 * 24 * 3600, 7 * 24 * 3600, 16 * 24 * 3600, 35 * 24 * 3600, 90 * 24 * 3600
+};
+
+static struct question_bank bank;
+static const char* patch_path;
+static const char* roster_path;
+static uint64_t* roster;
+static size_t roster_count;
+static volatile sig_atomic_t reload_requested;
+static volatile sig_atomic_t stats_requested;
+static int draining;
+static struct timespec drain_deadline;
+static int signal_fd = -1;
+static int answer_timeout_sec = ANSWER_TIMEOUT_SEC;
+static int accept_rate_limit;
+static int listen_backlog = 5;
+static int quiz_listen = -1;
+static int admin_listen = -1;
+static const char* admin_path;
+static struct admin_conn admin_conns[ADMIN_MAX_CONNS];
+static struct session* current_session;
+static struct session pending[PENDING_MAX];
+static unsigned long session_counter;
+static struct class_stats class_stats[CLASSES];
+static const char* const class_names[CLASSES] = { "practice", "exam" };
+static const int class_weights[CLASSES] = { 1, 4 };
+static int under_pressure;
+static struct load_monitor load;
+static uint64_t loop_histogram[LOOP_BUCKETS];
+static struct timespec busy_start;
+static int watchdog_ms = WATCHDOG_MS;
+static volatile sig_atomic_t stalls;
+static unsigned long evictions;
+static uint64_t zerocopy_sends;
+static uint64_t zerocopy_bytes;
+static uint64_t zerocopy_copied;
+static struct quiz_index search_index;
+static unsigned int search_version;
+static struct question_stats question_stats[MAX_QUESTIONS];
+static struct unique_counter unique_clients;
+static struct unique_counter unique_users;
+static struct rate_window rates;
+static struct plan_queue plans;
+static uint64_t rng_state;
+static struct user_history* histories;
+static size_t history_slots = HISTORY_SLOTS;
+static int dup_group[MAX_QUESTIONS];
+static struct schedule_store* schedule;
+static unsigned int schedule_dirty;
+
+/*
+ * rng_seed: Seeds the quiz random number generator.
+ * The generator is seeded once at startup so clients arriving within the same second no longer receive identical quizzes, which happened when srand(time(NULL)) was called per client.
+ */
+void rng_seed(uint64_t seed) {
+    /* xorshift must never be seeded with zero */
+    rng_state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * rng_next: Returns the next value of a xorshift64* generator.
+ * This generator is much cheaper than rand() and has no hidden global lock, making it suitable for picking questions on every quiz.
+ */
+uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * init_dup_groups: Groups near-duplicate questions so a quiz never asks two of them.
+ * If grouping would leave fewer distinct items than a quiz needs, every question is kept as its own group instead.
+ */
+void init_dup_groups(void) {
+    int distinct = 0;
+    if (dup_groups(bank.questions, bank.count, dup_group) >= 0) {
+        for (int i = 0; i < bank.count; i++) {
+            distinct += dup_group[i] == i && !bank.retired[i];
+        }
+    }
+    if (distinct < QUIZ_LENGTH) {
+        for (int i = 0; i < bank.count; i++) {
+            dup_group[i] = i;
+        }
+    }
+}
+
+/*
+ * generate_plan: Selects up to PLAN_CANDIDATES distinct questions for one quiz.
+ * This function runs a partial Fisher-Yates shuffle over the question indices, which picks distinct questions in a fixed number of steps instead of retrying on collisions. Retired questions are passed over, and near-duplicates count as one item: a question is also passed over if another member of its group is already in the plan.
+ */
+void generate_plan(struct quiz_plan* plan) {
+    int num_questions = bank.count;
+    int order[MAX_QUESTIONS];
+    unsigned char used[MAX_QUESTIONS] = {0};
+    for (int i = 0; i < num_questions; i++) {
+        order[i] = i;
+    }
+    plan->count = 0;
+    for (int i = 0; i < num_questions && plan->count < PLAN_CANDIDATES; i++) {
+        /* Swap a random remaining question into position i */
+        int j = i + (int)(rng_next() % (uint64_t)(num_questions - i));
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+        if (bank.retired[order[i]] || used[dup_group[order[i]]]) continue;
+        used[dup_group[order[i]]] = 1;
+        plan->candidates[plan->count++] = order[i];
+    }
+    plans.generated++;
+}
+
+/*
+ * fill_plan_queue: Tops up the plan queue while the server is idle.
+ * This function is called before waiting for the next client so the selection work happens outside of any quiz, and starting a quiz becomes a single pop.
+ */
+void fill_plan_queue(void) {
+    while (plans.tail - plans.head < PLAN_QUEUE_DEPTH) {
+        generate_plan(&plans.ring[plans.tail % PLAN_QUEUE_DEPTH]);
+        plans.tail++;
+    }
+}
+
+/*
+ * pop_plan: Takes the next precomputed quiz plan from the queue.
+ * If the queue has run dry the plan is generated on the spot and the starvation is counted.
+ */
+void pop_plan(struct quiz_plan* plan) {
+    if (plans.head == plans.tail) {
+        plans.starved++;
+        generate_plan(plan);
+    } else {
+        *plan = plans.ring[plans.head % PLAN_QUEUE_DEPTH];
+        plans.head++;
+    }
+    plans.served++;
+}
+
+/*
+ * close_attachments: Closes the attachment files held open by a bank.
+ */
+void close_attachments(struct question_bank* b) {
+    for (int i = 0; i < b->count; i++) {
+        if (b->attachment_names[i] != NULL) close(b->attachment_fds[i]);
+    }
+}
+
+/*
+ * open_attachments: Opens the attachment file of every question that has one.
+ * The files stay open so each send is a sendfile() from the page cache. A question whose attachment cannot be opened cannot be asked, so it is retired with a warning instead of failing the whole bank.
+ */
+void open_attachments(struct question_bank* b) {
+    for (int i = 0; i < QuizCount; i++) {
+        if (QuizAttach[i] == NULL || b->retired[i] || b->questions[i] != QuizQ[i]) continue;
+        struct stat st;
+        int fd = open(QuizAttach[i], O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            perror(QuizAttach[i]);
+            if (fd >= 0) close(fd);
+            b->retired[i] = 1;
+            continue;
+        }
+        /* Clients save the file under its base name */
+        const char* slash = strrchr(QuizAttach[i], '/');
+        b->attachment_names[i] = slash != NULL ? slash + 1 : QuizAttach[i];
+        b->attachment_fds[i] = fd;
+        b->attachment_sizes[i] = st.st_size;
+    }
+}
+
+/*
+ * load_bank: Rebuilds the live bank from QuizDB.h and the patch file, if any.
+ * The patch is a text file with one change per line, fields separated by tabs:
+ *     edit <number> <question> <answer>
+ *     add <question> <answer>
+ *     retire <number>
+ * Blank lines and lines starting with '#' are ignored. The new bank is built on the side and only replaces the live one if the whole patch applies and enough questions remain for a quiz, so a bad patch leaves the server running on the previous version. Returns 0 on success or -1 on error.
+ */
+int load_bank(void) {
+    static struct question_bank next;
+    memset(&next, 0, sizeof(next));
+    for (int i = 0; i < QuizCount; i++) {
+        next.questions[i] = QuizQ[i];
+        next.answers[i] = QuizA[i];
+        next.question_frames[i] = QuizQFrame[i];
+        next.question_frame_len[i] = QuizQFrameLen[i];
+        next.wrong_frames[i] = QuizWrongFrame[i];
+        next.wrong_frame_len[i] = QuizWrongFrameLen[i];
+        if (QuizOpt[i][0] != NULL) {
+            next.options[i] = QuizOpt[i];
+            next.option_len[i] = QuizOptLen[i];
+            next.choice_mask[i] = QuizMask[i];
+        }
+        if (QuizTemplate[i].vars != NULL) {
+            next.templates[i] = &QuizTemplate[i];
+        }
+    }
+    next.count = QuizCount;
+
+    if (patch_path != NULL) {
+        FILE* fp = fopen(patch_path, "r");
+        if (fp == NULL) {
+            perror(patch_path);
+            return -1;
+        }
+        /* Read the whole patch; edited questions point into this buffer */
+        size_t len = 0, cap = 4096;
+        next.patch = malloc(cap);
+        while (next.patch != NULL) {
+            len += fread(next.patch + len, 1, cap - len - 1, fp);
+            if (len < cap - 1) break;
+            char* grown = realloc(next.patch, cap * 2);
+            if (grown == NULL) free(next.patch);
+            next.patch = grown;
+            cap *= 2;
+        }
+        fclose(fp);
+        if (next.patch == NULL) {
+            fprintf(stderr, "%s: out of memory\n", patch_path);
+            return -1;
+        }
+        next.patch[len] = '\0';
+
+        int line_no = 0;
+        char* save = NULL;
+        for (char* line = strtok_r(next.patch, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+            line_no++;
+            line[strcspn(line, "\r")] = '\0';
+            if (line[0] == '\0' || line[0] == '#') continue;
+
+            /* Split the line into at most four tab-separated fields */
+            char* field[4] = {line, NULL, NULL, NULL};
+            int fields = 1;
+            for (char* p = line; *p && fields < 4; p++) {
+                if (*p == '\t') {
+                    *p = '\0';
+                    field[fields++] = p + 1;
+                }
+            }
+
+            /* A question number must be all digits, so a typo is rejected rather than read as question 0 */
+            int q = -1;
+            if (fields > 1) {
+                char* end;
+                long number = strtol(field[1], &end, 10);
+                if (end != field[1] && *end == '\0' && number >= 0 && number < next.count) q = (int)number;
+            }
+            if (strcmp(field[0], "edit") == 0 && fields == 4 && q >= 0 && q < next.count) {
+                next.questions[q] = field[2];
+                next.answers[q] = field[3];
+                /* The prebuilt frames no longer match the text, and the question becomes free-text */
+                next.question_frames[q] = NULL;
+                next.wrong_frames[q] = NULL;
+                next.options[q] = NULL;
+                next.templates[q] = NULL;
+            } else if (strcmp(field[0], "add") == 0 && fields == 3 && next.count < MAX_QUESTIONS) {
+                next.questions[next.count] = field[1];
+                next.answers[next.count] = field[2];
+                next.count++;
+            } else if (strcmp(field[0], "retire") == 0 && fields == 2 && q >= 0 && q < next.count) {
+                next.retired[q] = 1;
+            } else {
+                fprintf(stderr, "%s:%d: invalid patch line\n", patch_path, line_no);
+                free(next.patch);
+                return -1;
+            }
+        }
+    }
+
+    open_attachments(&next);
+
+    int live = 0;
+    for (int i = 0; i < next.count; i++) {
+        live += !next.retired[i];
+    }
+    if (live < QUIZ_LENGTH) {
+        fprintf(stderr, "Patch leaves %d questions, a quiz needs %d\n", live, QUIZ_LENGTH);
+        close_attachments(&next);
+        free(next.patch);
+        return -1;
+    }
+
+    /* Swap in the new version and drop plans built from the old one */
+    close_attachments(&bank);
+    free(bank.patch);
+    next.version = bank.version + 1;
+    bank = next;
+    plans.head = plans.tail;
+    init_dup_groups();
+    return 0;
+}
+
+/*
+ * handle_reload: SIGHUP handler asking the main loop to reload the patch file.
+ */
+void handle_reload(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
+/*
+ * handle_stats: SIGUSR1 handler asking the main loop to print statistics.
+ */
+void handle_stats(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+/*
+ * elapsed_ns: Returns the nanoseconds between two monotonic clock readings.
+ */
+static inline uint64_t elapsed_ns(const struct timespec* start, const struct timespec* end) {
+    return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ULL + (uint64_t)end->tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+/*
+ * hll_add: Adds an item, given as a well-mixed 64-bit hash, to a sketch.
+ * The top HLL_BITS bits pick a register, which keeps the longest run of leading zeros seen in the remaining bits.
+ */
+void hll_add(struct hll* h, uint64_t hash) {
+    unsigned int index = (unsigned int)(hash >> (64 - HLL_BITS));
+    uint64_t rest = hash << HLL_BITS;
+    uint8_t rank = rest == 0 ? 64 - HLL_BITS + 1 : (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > h->registers[index]) h->registers[index] = rank;
+}
+
+/*
+ * hll_merge: Folds sketch src into dst, so dst counts the union of both.
+ */
+void hll_merge(struct hll* dst, const struct hll* src) {
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (src->registers[i] > dst->registers[i]) dst->registers[i] = src->registers[i];
+    }
+}
+
+/*
+ * hll_estimate: Estimates the number of distinct items in a sketch, to within about 3%.
+ * Small counts, where many registers are still empty, use linear counting instead of the raw estimate.
+ */
+double hll_estimate(const struct hll* h) {
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += 1.0 / (double)(1ULL << h->registers[i]);
+        zeros += h->registers[i] == 0;
+    }
+    double m = HLL_REGISTERS;
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+    return estimate;
+}
+
+/*
+ * unique_rotate: Moves a counter on to the hour and day containing now, closing the windows that have ended.
+ */
+void unique_rotate(struct unique_counter* c, uint32_t now) {
+    uint32_t hour_id = now / 3600, day_id = now / 86400;
+    if (hour_id != c->hour_id) {
+        c->last_hour = c->hour_id == hour_id - 1 ? hll_estimate(&c->hour) : 0;
+        if (c->hour_id / 24 == c->day_id) hll_merge(&c->day, &c->hour);
+        memset(&c->hour, 0, sizeof(c->hour));
+        c->hour_id = hour_id;
+    }
+    if (day_id != c->day_id) {
+        c->last_day = c->day_id == day_id - 1 ? hll_estimate(&c->day) : 0;
+        memset(&c->day, 0, sizeof(c->day));
+        c->day_id = day_id;
+    }
+}
+
+/*
+ * unique_add: Counts an item, given as a 64-bit hash, in the current hour and day.
+ */
+void unique_add(struct unique_counter* c, uint64_t hash, uint32_t now) {
+    unique_rotate(c, now);
+    hll_add(&c->hour, dup_mix(hash));
+}
+
+/*
+ * unique_print: Writes the distinct counts of the current and previous hour and day.
+ */
+void unique_print(FILE* out, const char* what, struct unique_counter* c) {
+    unique_rotate(c, (uint32_t)time(NULL));
+    struct hll today = c->day;
+    hll_merge(&today, &c->hour);
+    fprintf(out, "unique %s: this hour %.0f last hour %.0f today %.0f yesterday %.0f\n",
+            what, hll_estimate(&c->hour), c->last_hour, hll_estimate(&today), c->last_day);
+}
+
+/*
+ * rate_add: Counts one event in the bucket of the current second.
+ */
+void rate_add(enum rate_event event) {
+    uint32_t now = (uint32_t)time(NULL);
+    int b = now % RATE_SECONDS;
+    if (rates.second[b] != now) {
+        memset(rates.count[b], 0, sizeof(rates.count[b]));
+        rates.second[b] = now;
+    }
+    rates.count[b][event]++;
+}
+
+/*
+ * rate_this_second: Returns how many events of a kind were counted in the current second.
+ */
+uint32_t rate_this_second(enum rate_event event) {
+    uint32_t now = (uint32_t)time(NULL);
+    int b = now % RATE_SECONDS;
+    return rates.second[b] == now ? rates.count[b][event] : 0;
+}
+
+/*
+ * rate_per_second: Returns the average rate of an event per second over the last RATE_SECONDS seconds.
+ */
+double rate_per_second(enum rate_event event) {
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t total = 0;
+    for (int b = 0; b < RATE_SECONDS; b++) {
+        if (now - rates.second[b] < RATE_SECONDS) total += rates.count[b][event];
+    }
+    return (double)total / RATE_SECONDS;
+}
+
+/*
+ * print_stats: Writes the server statistics to a stream.
+ * This covers the plan queue, the number of distinct client addresses and users per hour and day, the queue wait of each priority class, recent event rates and, for every question asked so far, how often it was answered right, wrong or not at all and the average time clients took to answer.
+ */
+void print_stats(FILE* out) {
+    fprintf(out, "plans generated %lu served %lu starved %lu queued %u\n",
+            plans.generated, plans.served, plans.starved, plans.tail - plans.head);
+    unique_print(out, "clients", &unique_clients);
+    unique_print(out, "users", &unique_users);
+    fprintf(out, "history slots %zu, memory pressure %s, slow clients evicted %lu\n",
+            history_slots, under_pressure ? "yes" : "no", evictions);
+    fprintf(out, "zerocopy sends %llu (%llu bytes), copied by the kernel after all %llu\n",
+            (unsigned long long)zerocopy_sends, (unsigned long long)zerocopy_bytes, (unsigned long long)zerocopy_copied);
+    fprintf(out, "load over %ds: cpu %.0f%% occupancy %.0f%% lag %.1f ms, hint %s (scale out %lu, scale in %lu)\n",
+            LOAD_WINDOW_SEC, load.utilization * 100, load.occupancy * 100, load.lag_ms,
+            load.hint > 0 ? "scale out" : load.hint < 0 ? "scale in" : "steady", load.scale_out, load.scale_in);
+    fprintf(out, "loop stalls over %d ms: %d; busy stretches:", watchdog_ms, (int)stalls);
+    for (int b = 0; b < LOOP_BUCKETS; b++) {
+        if (loop_histogram[b] == 0) continue;
+        if (b < LOOP_BUCKETS - 1) fprintf(out, " <%lluus %llu", 1ULL << b, (unsigned long long)loop_histogram[b]);
+        else fprintf(out, " >=%lluus %llu", 1ULL << (b - 1), (unsigned long long)loop_histogram[b]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "exam roster %zu users\n", roster_count);
+    for (int c = CLASSES - 1; c >= 0; c--) {
+        const struct class_stats* st = &class_stats[c];
+        fprintf(out, "%s sessions: served %llu shed %llu, queue wait avg %.1f ms max %.1f ms\n", class_names[c],
+                (unsigned long long)st->served, (unsigned long long)st->shed,
+                st->served > 0 ? st->wait_ns / 1e6 / st->served : 0.0, st->wait_max_ns / 1e6);
+    }
+    fprintf(out, "per second over %ds: accepted %.1f completed %.1f correct %.1f wrong %.1f errors %.1f rejected %.1f\n",
+            RATE_SECONDS, rate_per_second(RATE_ACCEPTED), rate_per_second(RATE_COMPLETED),
+            rate_per_second(RATE_CORRECT), rate_per_second(RATE_WRONG), rate_per_second(RATE_ERRORS),
+            rate_per_second(RATE_REJECTED));
+    fprintf(out, "%-4s %8s %8s %8s %8s %10s  %s\n", "q", "asked", "correct", "wrong", "timeout", "think ms", "question");
+    for (int q = 0; q < bank.count; q++) {
+        const struct question_stats* st = &question_stats[q];
+        if (st->asked == 0) continue;
+        uint64_t answered = st->correct + st->wrong;
+        fprintf(out, "%-4d %8llu %8llu %8llu %8llu %10.1f  %.40s\n", q,
+                (unsigned long long)st->asked, (unsigned long long)st->correct,
+                (unsigned long long)st->wrong, (unsigned long long)st->timed_out,
+                answered > 0 ? st->think_ns / 1e6 / answered : 0.0, bank.questions[q]);
+    }
+    fflush(out);
+}
+
+/*
+ * hash_user: Hashes a user name with 64-bit FNV-1a.
+ */
+uint64_t hash_user(const char* user) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (; *user; user++) {
+        h ^= (unsigned char)*user;
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+/*
+ * compare_hash: qsort() and bsearch() comparison of two user name hashes.
+ */
+int compare_hash(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * load_roster: Reads the exam roster, the users allowed to ask for exam priority, from roster_path.
+ * The file has one user name per line; blank lines and lines starting with '#' are ignored. Names are kept as a sorted array of their hashes, so checking a handshake is one binary search. A file that cannot be read leaves the previous roster in place. Returns 0 on success or -1 on error.
+ */
+int load_roster(void) {
+    if (roster_path == NULL) return 0;
+    FILE* fp = fopen(roster_path, "r");
+    if (fp == NULL) {
+        perror(roster_path);
+        return -1;
+    }
+    uint64_t* next = NULL;
+    size_t count = 0, cap = 0;
+    char line[MAX_LINES];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (count == cap) {
+            cap = cap > 0 ? cap * 2 : 64;
+            uint64_t* grown = realloc(next, cap * sizeof(*next));
+            if (grown == NULL) {
+                fprintf(stderr, "%s: out of memory\n", roster_path);
+                free(next);
+                fclose(fp);
+                return -1;
+            }
+            next = grown;
+        }
+        next[count++] = hash_user(line);
+    }
+    fclose(fp);
+    qsort(next, count, sizeof(*next), compare_hash);
+    free(roster);
+    roster = next;
+    roster_count = count;
+    return 0;
+}
+
+/*
+ * roster_has: Tells whether a user is on the exam roster.
+ */
+int roster_has(const char* user) {
+    uint64_t h = hash_user(user);
+    return roster_count > 0 && bsearch(&h, roster, roster_count, sizeof(*roster), compare_hash) != NULL;
+}
+
+/*
+ * find_history: Returns the history entry for a user, claiming the slot if it belongs to someone else.
+ * The table is direct-mapped and of fixed size, so memory stays constant however many users connect. A user whose slot was taken over simply starts with an empty history, which at worst repeats a few questions.
+ */
+struct user_history* find_history(const char* user) {
+    uint64_t h = hash_user(user);
+    struct user_history* entry = &histories[h % history_slots];
+    /* A zero tag marks a free slot, so force the tag to be non-zero */
+    uint64_t tag = h | 1;
+    if (entry->tag != tag) {
+        memset(entry, 0, sizeof(*entry));
+        entry->tag = tag;
+    }
+    return entry;
+}
+
+/*
+ * history_probe: Computes the three filter bit positions for a question.
+ */
+static inline void history_probe(int question, unsigned int pos[3]) {
+    uint64_t h = ((uint64_t)question + 1) * 0x9E3779B97F4A7C15ULL;
+    pos[0] = (unsigned int)((h >> 8) % HISTORY_BITS);
+    pos[1] = (unsigned int)((h >> 24) % HISTORY_BITS);
+    pos[2] = (unsigned int)((h >> 40) % HISTORY_BITS);
+}
+
+/*
+ * history_seen: Tests whether a question is (probably) in a user's history.
+ * False positives only make selection skip a question the user has not seen; a question that was seen is never reported as new.
+ */
+int history_seen(const struct user_history* entry, int question) {
+    unsigned int pos[3];
+    history_probe(question, pos);
+    for (int i = 0; i < 3; i++) {
+        if (!(entry->bits[pos[i] / 64] & (1ULL << (pos[i] % 64)))) return 0;
+    }
+    return 1;
+}
+
+/*
+ * history_add: Records a question in a user's history.
+ */
+void history_add(struct user_history* entry, int question) {
+    unsigned int pos[3];
+    history_probe(question, pos);
+    for (int i = 0; i < 3; i++) {
+        entry->bits[pos[i] / 64] |= 1ULL << (pos[i] % 64);
+    }
+}
+
+/*
+ * choose_questions: Picks the questions for one quiz from a plan, skipping ones the user has recently seen.
+ * Unseen candidates are taken first in plan order. When the user has seen so much of the bank that the plan cannot supply a full quiz of new questions, the history is cleared and the remaining slots are filled from the seen candidates. Recording the questions in the history is left to the caller, once it knows which ones are asked. Anonymous clients (history NULL) simply get the first candidates.
+ */
+void choose_questions(const struct quiz_plan* plan, struct user_history* history, int selected[QUIZ_LENGTH]) {
+    int count = 0;
+    if (history == NULL) {
+        for (; count < QUIZ_LENGTH; count++) {
+            selected[count] = plan->candidates[count];
+        }
+        return;
+    }
+
+    int seen[PLAN_CANDIDATES];
+    int num_seen = 0;
+    for (int i = 0; i < plan->count && count < QUIZ_LENGTH; i++) {
+        if (history_seen(history, plan->candidates[i])) {
+            seen[num_seen++] = plan->candidates[i];
+        } else {
+            selected[count++] = plan->candidates[i];
+        }
+    }
+    if (count < QUIZ_LENGTH) {
+        /* The user has worked through most of the bank, so start over */
+        memset(history->bits, 0, sizeof(history->bits));
+        for (int i = 0; count < QUIZ_LENGTH; i++) {
+            selected[count++] = seen[i];
+        }
+    }
+}
+
+/*
+ * open_schedule: Maps the spaced-repetition store into memory.
+ * With a path the store is a shared mapping of that file, so review state survives restarts and the kernel writes it back in the background. Without a path an anonymous mapping is used and state lasts only as long as the server runs.
+ */
+void open_schedule(const char* path) {
+    size_t size = sizeof(struct schedule_store);
+    int fd = -1;
+    /* Fault the whole store in now rather than during the first quizzes */
+    int flags = MAP_SHARED | MAP_POPULATE;
+
+    if (path != NULL) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            perror("open");
+            exit(EXIT_FAILURE);
+        }
+        /* Extend the file to its full size; untouched records stay sparse */
+        if (ftruncate(fd, size) < 0) {
+            perror("ftruncate");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        flags |= MAP_ANONYMOUS;
+    }
+
+    schedule = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (schedule == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    if (fd >= 0) close(fd);
+
+    /* Start afresh if the file is new or was written with another layout */
+    if (schedule->magic != SCHEDULE_MAGIC || schedule->slots != SCHEDULE_SLOTS ||
+        schedule->max_questions != MAX_QUESTIONS || schedule->record_size != sizeof(struct schedule_record)) {
+        memset(schedule, 0, size);
+        schedule->magic = SCHEDULE_MAGIC;
+        schedule->slots = SCHEDULE_SLOTS;
+        schedule->max_questions = MAX_QUESTIONS;
+        schedule->record_size = sizeof(struct schedule_record);
+    }
+}
+
+/*
+ * find_schedule: Returns the spaced-repetition record for a user, claiming the slot if it belongs to someone else.
+ */
+struct schedule_record* find_schedule(const char* user) {
+    uint64_t h = hash_user(user);
+    /* Use different hash bits than the history table */
+    struct schedule_record* record = &schedule->records[(h >> 32) % SCHEDULE_SLOTS];
+    uint64_t tag = h | 1;
+    if (record->tag != tag) {
+        memset(record, 0, sizeof(*record));
+        record->tag = tag;
+    }
+    return record;
+}
+
+/*
+ * schedule_due: Collects up to max questions that are due for review, most overdue first.
+ * The due times of one user are a small contiguous array bounded by MAX_QUESTIONS, so a single pass keeping the k earliest entries in a sorted array is cheaper than maintaining a separate due-queue index. Returns the number of questions stored in selected.
+ */
+int schedule_due(const struct schedule_record* record, uint32_t now, int selected[], int max) {
+    int count = 0;
+    for (int q = 0; q < bank.count; q++) {
+        uint32_t due = record->due[q];
+        if (due == 0 || due > now || bank.retired[q]) continue;
+        if (count == max && due >= record->due[selected[count - 1]]) continue;
+        /* Insert q keeping selected ordered by due time */
+        int i = count < max ? count++ : count - 1;
+        while (i > 0 && record->due[selected[i - 1]] > due) {
+            selected[i] = selected[i - 1];
+            i--;
+        }
+        selected[i] = q;
+    }
+    return count;
+}
+
+/*
+ * schedule_update: Reschedules a question after the user answered it.
+ * A right answer moves the question up one level, doubling-or-more its review interval, while a wrong answer brings it back for review within minutes.
+ */
+void schedule_update(struct schedule_record* record, int question, int correct, uint32_t now) {
+    int max_level = sizeof(review_intervals) / sizeof(review_intervals[0]) - 1;
+    int level = correct ? record->level[question] + 1 : 1;
+    if (level > max_level) level = max_level;
+    record->level[question] = (uint8_t)level;
+    record->due[question] = now + review_intervals[level];
+}
+
+/*
+ * schedule_flush: Schedules write-back of the store after a batch of quizzes.
+ * Updates go to the shared mapping immediately; this only asks the kernel to start writing dirty pages every SCHEDULE_SYNC_QUIZZES quizzes, without blocking the server.
+ */
+void schedule_flush(void) {
+    if (++schedule_dirty < SCHEDULE_SYNC_QUIZZES) return;
+    msync(schedule, sizeof(struct schedule_store), MS_ASYNC);
+    schedule_dirty = 0;
+}
+
+/*
+ * out_evict: Disconnects a client that is not taking its output, dropping what was queued for it.
+ * The session's next read sees end of file and it ends the usual way.
+ */
+void out_evict(struct session* session, const char* reason) {
+    if (session->evicted) return;
+    session->evicted = 1;
+    session->out.count = 0;
+    session->out.bytes = 0;
+    shutdown(session->sock, SHUT_RDWR);
+    /* Closing with a reset makes the kernel drop, rather than still send, memory lent to it by MSG_ZEROCOPY */
+    if (session->out.zerocopy_pending > 0) {
+        struct linger abort_close = { 1, 0 };
+        setsockopt(session->sock, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+    }
+    evictions++;
+    printf("<Evicted session %lu: %s>\n", session->id, reason);
+    fflush(stdout);
+}
+
+/*
+ * out_push: Appends a part to the session's output queue, evicting the client if the queue is full or over its memory cap.
+ */
+void out_push(struct session* session, const char* data, int fd, off_t offset, size_t len) {
+    struct out_queue* q = &session->out;
+    if (session->evicted || len == 0) return;
+    if (q->count == OUT_PARTS || (data != NULL && q->bytes + len > OUT_CAP)) {
+        out_evict(session, "output backlog over the cap");
+        return;
+    }
+    struct out_part* part = &q->parts[(q->head + q->count) % OUT_PARTS];
+    part->data = data;
+    part->fd = fd;
+    part->offset = offset;
+    part->len = len;
+    q->count++;
+    if (data != NULL) q->bytes += len;
+}
+
+/*
+ * out_flush: Sends as much of the session's output queue as the socket takes without blocking.
+ * Consecutive memory parts go out together in one gathered sendmsg(); file parts go out with sendfile(). A gathered send of at least ZEROCOPY_MIN bytes that references no spill memory uses MSG_ZEROCOPY, so the kernel sends from the frame itself instead of copying it; below that size, pinning pages costs more than copying. A partial write leaves the rest of its part at the head of the queue, so the next flush resumes exactly where this one stopped. Returns 0 once the queue is empty, 1 if output remains, or -1 if the connection failed.
+ */
+int out_flush(struct session* session) {
+    struct out_queue* q = &session->out;
+    while (q->count > 0) {
+        struct out_part* head = &q->parts[q->head];
+        ssize_t n;
+        if (head->data == NULL) {
+            off_t offset = head->offset;
+            n = sendfile(session->sock, head->fd, &offset, head->len);
+        } else {
+            struct iovec iov[OUT_PARTS];
+            int k = 0;
+            size_t total = 0;
+            int spilled = 0;
+            while (k < q->count && q->parts[(q->head + k) % OUT_PARTS].data != NULL) {
+                const struct out_part* part = &q->parts[(q->head + k) % OUT_PARTS];
+                iov[k].iov_base = (void*)part->data;
+                iov[k++].iov_len = part->len;
+                total += part->len;
+                spilled |= part->data >= q->spill && part->data < q->spill + sizeof(q->spill);
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = k;
+            int zerocopy = q->zerocopy && !spilled && total >= ZEROCOPY_MIN;
+            n = sendmsg(session->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (zerocopy ? MSG_ZEROCOPY : 0));
+            /* Out of memory to pin pages: send this one the ordinary way */
+            if (n < 0 && zerocopy && errno == ENOBUFS) {
+                zerocopy = 0;
+                n = sendmsg(session->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            }
+            if (n >= 0 && zerocopy) {
+                q->zerocopy_pending++;
+                zerocopy_sends++;
+                zerocopy_bytes += (uint64_t)n;
+            }
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            out_evict(session, "connection failed");
+            return -1;
+        }
+
+        /* Drop what was sent, resuming a partly sent part where it stopped */
+        q->stalled_since.tv_sec = 0;
+        while (n > 0) {
+            struct out_part* part = &q->parts[q->head];
+            size_t take = (size_t)n < part->len ? (size_t)n : part->len;
+            if (part->data != NULL) {
+                part->data += take;
+                q->bytes -= take;
+            } else {
+                part->offset += take;
+            }
+            part->len -= take;
+            n -= take;
+            if (part->len == 0) {
+                q->head = (q->head + 1) % OUT_PARTS;
+                q->count--;
+            }
+        }
+    }
+    if (q->count == 0) {
+        q->spill_len = 0;
+        return 0;
+    }
+    if (q->stalled_since.tv_sec == 0) clock_gettime(CLOCK_MONOTONIC, &q->stalled_since);
+    return 1;
+}
+
+/*
+ * zerocopy_reap: Collects the kernel's MSG_ZEROCOPY completion notices from the socket's error queue.
+ * Each notice covers a range of sends; once a send is complete the kernel no longer reads the memory it was given. The kernel also reports when it had to copy after all (always the case on loopback), which is counted. Returns 1 if any notice was read.
+ */
+int zerocopy_reap(struct session* session) {
+    int reaped = 0;
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(session->sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return reaped;
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err* err = (const struct sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            unsigned int done = err->ee_data - err->ee_info + 1;
+            session->out.zerocopy_pending -= done < session->out.zerocopy_pending ? done : session->out.zerocopy_pending;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zerocopy_copied += done;
+            reaped = 1;
+        }
+    }
+}
+
+/*
+ * send_frame: Sends one protocol message assembled from several pieces.
+ * The pieces are queued by reference and gathered by the kernel straight from where they live (the question bank, constant strings), so no message is copied or formatted into a temporary buffer. Sending a line in one call also matters for latency: writing the text and its newline separately lets Nagle's algorithm hold the newline back until the client's delayed ACK, adding tens of milliseconds to every message. The socket never blocks; whatever the client does not take now stays queued and is sent while the server waits for the client's next line.
+ */
+void send_frame(struct session* session, const struct iovec* parts, int num_parts) {
+    for (int i = 0; i < num_parts; i++) {
+        out_push(session, parts[i].iov_base, -1, 0, parts[i].iov_len);
+    }
+    out_flush(session);
+}
+
+/*
+ * send_copy: Sends a message built on the stack, copying it into the session's spill buffer first.
+ */
+void send_copy(struct session* session, const char* text, size_t len) {
+    struct out_queue* q = &session->out;
+    if (session->evicted) return;
+    if (q->spill_len + len > sizeof(q->spill)) {
+        out_evict(session, "output backlog over the cap");
+        return;
+    }
+    memcpy(q->spill + q->spill_len, text, len);
+    out_push(session, q->spill + q->spill_len, -1, 0, len);
+    q->spill_len += (int)len;
+    out_flush(session);
+}
+
+/*
+ * send_message: Sends a message followed by a newline to a socket.
+ * This function transmits a given string to the specified socket and appends a newline character to ensure proper line-based communication. Both go out in one gathered send, making it suitable for sending questions, feedback, and score messages to the client.
+ */
+void send_message(struct session* session, const char* message) {
+    struct iovec parts[2] = {
+        { (void*)message, strlen(message) },
+        /* Append newline for line-based protocol */
+        { "\n", 1 }
+    };
+    send_frame(session, parts, 2);
+}
+
+/*
+ * send_question: Sends question q, using its prebuilt frame unless a patch changed it.
+ */
+void send_question(struct session* session, int q) {
+    if (bank.question_frames[q] != NULL) {
+        struct iovec frame = { (void*)bank.question_frames[q], bank.question_frame_len[q] };
+        send_frame(session, &frame, 1);
+    } else {
+        send_message(session, bank.questions[q]);
+    }
+}
+
+/*
+ * send_wrong_answer: Sends the feedback for a wrong answer to question q.
+ * Compiled-in questions have the whole feedback line prebuilt; for patched questions it is gathered around the answer text.
+ */
+void send_wrong_answer(struct session* session, int q) {
+    if (bank.wrong_frames[q] != NULL) {
+        struct iovec frame = { (void*)bank.wrong_frames[q], bank.wrong_frame_len[q] };
+        send_frame(session, &frame, 1);
+    } else {
+        const char* right = bank.answers[q];
+        struct iovec parts[3] = {
+            { "Wrong Answer. Right answer is ", 30 },
+            { (void*)right, strlen(right) },
+            { ".\n", 2 }
+        };
+        send_frame(session, parts, 3);
+    }
+}
+
+/*
+ * shuffle_options: Picks the order in which a multiple-choice question shows its options this time.
+ * Position i on screen (letter 'A' + i) shows option order[i] of QuizDB.h.
+ */
+void shuffle_options(unsigned char order[4]) {
+    for (int i = 0; i < 4; i++) {
+        order[i] = (unsigned char)i;
+    }
+    for (int i = 3; i > 0; i--) {
+        int j = (int)(rng_next() % (uint64_t)(i + 1));
+        unsigned char tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+/*
+ * send_choice_question: Sends a multiple-choice question with its options in shuffled order.
+ * The question and options go out on one line, so clients that read one line per question need no changes. The line is gathered from the question text, constant letter labels and the options themselves, so shuffling costs no formatting or copying.
+ */
+void send_choice_question(struct session* session, int q, const unsigned char order[4]) {
+    static const char* const labels[4] = { "  A) ", "  B) ", "  C) ", "  D) " };
+    const char* const* options = bank.options[q];
+    struct iovec parts[10];
+    parts[0].iov_base = (void*)bank.questions[q];
+    parts[0].iov_len = strlen(bank.questions[q]);
+    for (int i = 0; i < 4; i++) {
+        parts[1 + 2 * i].iov_base = (void*)labels[i];
+        parts[1 + 2 * i].iov_len = 5;
+        parts[2 + 2 * i].iov_base = (void*)options[order[i]];
+        parts[2 + 2 * i].iov_len = bank.option_len[q][order[i]];
+    }
+    parts[9].iov_base = "\n";
+    parts[9].iov_len = 1;
+    send_frame(session, parts, 10);
+}
+
+/*
+ * grade_choice: Checks a multiple-choice answer given as letters, e.g. "B" or "a, c".
+ * The letters are turned into a mask of the options the client saw, mapped back through the shuffle to the original options and compared with the right-answer mask in one go. Anything other than letters A-D, spaces and commas makes the answer wrong.
+ */
+int grade_choice(const char* answer, int q, const unsigned char order[4]) {
+    unsigned int mask = 0;
+    for (const char* p = answer; *p; p++) {
+        if (*p == ' ' || *p == ',') continue;
+        int letter = (*p | 0x20) - 'a';
+        if (letter < 0 || letter > 3) return 0;
+        mask |= 1u << order[letter];
+    }
+    return mask == bank.choice_mask[q];
+}
+
+/*
+ * send_wrong_choice: Sends the feedback for a wrong multiple-choice answer, naming the right letters as the client saw them.
+ */
+void send_wrong_choice(struct session* session, int q, const unsigned char order[4]) {
+    static const char letters[] = "ABCD";
+    struct iovec parts[6] = { { "Wrong Answer. Right answer is ", 30 } };
+    int count = 1;
+    for (int i = 0; i < 4; i++) {
+        if (bank.choice_mask[q] & (1u << order[i])) {
+            parts[count].iov_base = (void*)&letters[i];
+            parts[count++].iov_len = 1;
+        }
+    }
+    parts[count].iov_base = ".\n";
+    parts[count++].iov_len = 2;
+    send_frame(session, parts, count);
+}
+
+/*
+ * send_template_question: Sends a templated question filled in with the value picked for this turn.
+ * The line is gathered from the template text and the value, so it is rendered without formatting or allocation.
+ */
+void send_template_question(struct session* session, int q, const struct quiz_var* var) {
+    const struct quiz_template* t = bank.templates[q];
+    struct iovec parts[4] = {
+        { (void*)t->prefix, t->prefix_len },
+        { (void*)var->text, var->len },
+        { (void*)t->suffix, t->suffix_len },
+        { "\n", 1 }
+    };
+    send_frame(session, parts, 4);
+}
+
+/*
+ * send_attachment: Sends the attachment of question q ahead of the question.
+ * The file goes out as a length-prefixed frame, a line "ATTACH <name> <size>" followed by exactly <size> raw bytes. The bytes are queued as a file range and sent with sendfile() straight from the page cache, so the server never copies them into user space. Returns 0 on success or -1 if the connection failed.
+ */
+int send_attachment(struct session* session, int q) {
+    char header[MAX_LINES];
+    int len = snprintf(header, sizeof(header), "ATTACH %s %lld\n", bank.attachment_names[q], (long long)bank.attachment_sizes[q]);
+    send_copy(session, header, (size_t)len);
+    out_push(session, NULL, bank.attachment_fds[q], 0, (size_t)bank.attachment_sizes[q]);
+    out_flush(session);
+    return session->evicted ? -1 : 0;
+}
+
+/*
+ * ask_question: Sends question q, first choosing the option order or template value for this turn and sending any attachment.
+ */
+void ask_question(struct session* session, int q, struct turn* turn) {
+    if (bank.attachment_names[q] != NULL && send_attachment(session, q) < 0) return;
+    if (bank.options[q] != NULL) {
+        shuffle_options(turn->order);
+        send_choice_question(session, q, turn->order);
+    } else if (bank.templates[q] != NULL) {
+        const struct quiz_template* t = bank.templates[q];
+        turn->var = &t->vars[rng_next() % t->num_vars];
+        send_template_question(session, q, turn->var);
+    } else {
+        send_question(session, q);
+    }
+}
+
+/*
+ * grade_answer: Returns whether an answer to question q is right for this turn.
+ */
+int grade_answer(const char* answer, int q, const struct turn* turn) {
+    if (bank.options[q] != NULL) return grade_choice(answer, q, turn->order);
+    if (bank.templates[q] != NULL) return strcmp(answer, turn->var->answer) == 0;
+    return strcmp(answer, bank.answers[q]) == 0;
+}
+
+/*
+ * send_wrong_feedback: Sends the feedback for a wrong answer to question q, naming the answer for this turn.
+ */
+void send_wrong_feedback(struct session* session, int q, const struct turn* turn) {
+    if (bank.options[q] != NULL) {
+        send_wrong_choice(session, q, turn->order);
+    } else if (bank.templates[q] != NULL) {
+        struct iovec parts[3] = {
+            { "Wrong Answer. Right answer is ", 30 },
+            { (void*)turn->var->answer, turn->var->answer_len },
+            { ".\n", 2 }
+        };
+        send_frame(session, parts, 3);
+    } else {
+        send_wrong_answer(session, q);
+    }
+}
+
+/*
+ * cgroup_file: Opens a file in the server's own cgroup v2 directory for reading.
+ * The directory is looked up in /proc/self/cgroup once. Returns NULL outside a cgroup v2 hierarchy, if the directory's path is too long, or if the file does not exist, as for limits in the root cgroup.
+ */
+FILE* cgroup_file(const char* name) {
+    static char dir[256];
+    if (dir[0] == '\0') {
+        strcpy(dir, "none");
+        FILE* fp = fopen("/proc/self/cgroup", "r");
+        if (fp != NULL) {
+            char line[256];
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                if (strncmp(line, "0::", 3) != 0) continue;
+                /* A path too long for the buffers is treated as no cgroup rather than cut short */
+                char* newline = strchr(line, '\n');
+                if (newline == NULL) break;
+                *newline = '\0';
+                if (snprintf(dir, sizeof(dir), "/sys/fs/cgroup%s", line + 3) >= (int)sizeof(dir)) strcpy(dir, "none");
+                break;
+            }
+            fclose(fp);
+        }
+    }
+    if (dir[0] != '/') return NULL;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return fopen(path, "r");
+}
+
+/*
+ * size_for_cgroup: Sizes the history table and listen backlog to the limits of the server's cgroup.
+ * The history table, by far the largest allocation, gets at most 1/HISTORY_MEMORY_SHARE of memory.max. Quizzes are served one at a time, so a CPU quota below one CPU slows every turn; the backlog of waiting clients shrinks in proportion. Without limits the compiled-in sizes are kept.
+ */
+void size_for_cgroup(void) {
+    char value[32];
+    long long memory = -1;
+    FILE* fp = cgroup_file("memory.max");
+    if (fp != NULL) {
+        if (fscanf(fp, "%31s", value) == 1 && strcmp(value, "max") != 0) memory = atoll(value);
+        fclose(fp);
+    }
+    if (memory > 0) {
+        while (history_slots > HISTORY_MIN_SLOTS &&
+               history_slots * sizeof(struct user_history) > (size_t)memory / HISTORY_MEMORY_SHARE) {
+            history_slots /= 2;
+        }
+    }
+
+    double cpus = 0;
+    long period;
+    fp = cgroup_file("cpu.max");
+    if (fp != NULL) {
+        if (fscanf(fp, "%31s %ld", value, &period) == 2 && strcmp(value, "max") != 0 && period > 0) {
+            cpus = atof(value) / period;
+        }
+        fclose(fp);
+    }
+    if (cpus > 0 && cpus < 1) {
+        listen_backlog = (int)(listen_backlog * cpus + 0.5);
+        if (listen_backlog < 1) listen_backlog = 1;
+    }
+
+    if (memory > 0 || cpus > 0) {
+        printf("<cgroup memory %lld MB, %.2f CPUs: %zu history slots, backlog %d>\n",
+               memory > 0 ? memory >> 20 : -1, cpus, history_slots, listen_backlog);
+    }
+}
+
+/*
+ * memory_pressure: Tells whether the server's cgroup is under memory pressure.
+ * Pressure is signalled by new high, max or oom events in memory.events since the last check, or by memory.pressure showing tasks stalled on memory for more than PRESSURE_AVG10 percent of the last ten seconds. The files are read at most once a second, and a signal counts for PRESSURE_HOLD_SEC so admission does not flap.
+ */
+int memory_pressure(void) {
+    static time_t checked, until;
+    static long long last_events = -1;
+    time_t now = time(NULL);
+    if (now == checked) return now < until;
+    checked = now;
+
+    FILE* fp = cgroup_file("memory.events");
+    if (fp == NULL) return 0;
+    char key[32];
+    long long value, events = 0;
+    while (fscanf(fp, "%31s %lld", key, &value) == 2) {
+        if (strcmp(key, "high") == 0 || strcmp(key, "max") == 0 || strcmp(key, "oom") == 0) events += value;
+    }
+    fclose(fp);
+    int signalled = last_events >= 0 && events > last_events;
+    last_events = events;
+
+    double avg10;
+    fp = cgroup_file("memory.pressure");
+    if (fp != NULL) {
+        if (fscanf(fp, "some avg10=%lf", &avg10) == 1 && avg10 > PRESSURE_AVG10) signalled = 1;
+        fclose(fp);
+    }
+    if (signalled) until = now + PRESSURE_HOLD_SEC;
+    return now < until;
+}
+
+/*
+ * shed_memory: Frees what the server can rebuild later, i.e. the admin search index, and returns free heap pages to the kernel.
+ */
+void shed_memory(void) {
+    index_free(&search_index);
+    search_version = 0;
+    malloc_trim(0);
+}
+
+/*
+ * load_tick: Closes the load window once LOAD_WINDOW_SEC have passed and updates the scale hint.
+ */
+void load_tick(void) {
+    static const char* const hints[] = { "scale in", "steady", "scale out" };
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (load.window_start.tv_sec == 0) {
+        load.window_start = now;
+        return;
+    }
+
+    /* Count the session in progress and the clients queued behind it up to now */
+    if (load.session_mark.tv_sec != 0) {
+        load.session_ns += elapsed_ns(&load.session_mark, &now);
+        load.session_mark = now;
+    }
+    for (int i = 0; i < PENDING_MAX; i++) {
+        const struct session* s = &pending[i];
+        if (s->sock < 0 || s == current_session || s->queued.tv_sec == 0) continue;
+        if (elapsed_ns(&s->queued, &now) > load.lag_max_ns) load.lag_max_ns = elapsed_ns(&s->queued, &now);
+    }
+
+    uint64_t wall = elapsed_ns(&load.window_start, &now);
+    if (wall < LOAD_WINDOW_SEC * 1000000000ULL) return;
+
+    load.utilization = load.idle_ns < wall ? 1.0 - (double)load.idle_ns / wall : 0.0;
+    load.occupancy = load.session_ns < wall ? (double)load.session_ns / wall : 1.0;
+    load.lag_ms = load.lag_max_ns / 1e6;
+    int want = 0;
+    if (load.occupancy > LOAD_HIGH || load.lag_ms > LOAD_LAG_MS) want = 1;
+    else if (load.occupancy < LOAD_LOW && load.lag_max_ns == 0) want = -1;
+
+    if (want == load.hint) {
+        load.streak = 0;
+    } else {
+        load.streak = want == load.pending ? load.streak + 1 : 1;
+        load.pending = want;
+        if (load.streak >= LOAD_STREAK) {
+            load.hint = want;
+            load.streak = 0;
+            if (want > 0) load.scale_out++;
+            if (want < 0) load.scale_in++;
+            printf("<Scale hint: %s>\n", hints[want + 1]);
+            fflush(stdout);
+        }
+    }
+
+    load.window_start = now;
+    load.idle_ns = load.session_ns = load.lag_max_ns = 0;
+}
+
+/*
+ * handle_stall: Reports a loop stall from the watchdog timer's SIGALRM.
+ * The server has not been back in poll() for watchdog_ms, so something on the loop is blocking. The handler prints the session being served and the stack of the blocked code to stderr using only async-signal-safe calls, and counts the stall.
+ */
+void handle_stall(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    stalls++;
+
+    char msg[64] = "<Stall: loop busy, session ";
+    int len = (int)strlen(msg);
+    unsigned long id = current_session != NULL ? current_session->id : 0;
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + id % 10);
+        id /= 10;
+    } while (id > 0);
+    while (n > 0) msg[len++] = digits[--n];
+    msg[len++] = '>';
+    msg[len++] = '\n';
+    if (write(STDERR_FILENO, msg, len) < 0) {
+        /* Nothing more can be done from a signal handler */
+    }
+
+    void* frames[WATCHDOG_FRAMES];
+    backtrace_symbols_fd(frames, backtrace(frames, WATCHDOG_FRAMES), STDERR_FILENO);
+    errno = saved_errno;
+}
+
+/*
+ * watch_busy: Marks the loop as busy from now on and arms the watchdog.
+ * The timer is one-shot and cancelled by watch_idle when the loop gets back to poll(), so it only fires for a stall and an idle server is never woken by it.
+ */
+void watch_busy(const struct timespec* now) {
+    busy_start = *now;
+    struct itimerval timer = { { 0, 0 }, { watchdog_ms / 1000, (watchdog_ms % 1000) * 1000 } };
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/*
+ * watch_idle: Disarms the watchdog and adds the busy stretch that just ended to the loop histogram.
+ * Bucket b counts stretches shorter than 2^b microseconds (and at least half that); the last bucket takes everything longer.
+ */
+void watch_idle(const struct timespec* now) {
+    if (busy_start.tv_sec == 0) return;
+    static const struct itimerval off;
+    setitimer(ITIMER_REAL, &off, NULL);
+    uint64_t us = elapsed_ns(&busy_start, now) / 1000;
+    int b = us > 0 ? 64 - __builtin_clzll(us) : 0;
+    loop_histogram[b < LOOP_BUCKETS ? b : LOOP_BUCKETS - 1]++;
+}
+
+/*
+ * pending_waiting: Tells whether a pending slot holds a client that is connected but not being served yet.
+ */
+static inline int pending_waiting(const struct session* s) {
+    return s->sock >= 0 && s != current_session;
+}
+
+/*
+ * pending_close: Closes a client that has not been served, optionally telling it why first, and frees its slot.
+ */
+void pending_close(struct session* s, const char* notice) {
+    if (notice != NULL) send(s->sock, notice, strlen(notice), MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(s->sock);
+    s->sock = -1;
+}
+
+/*
+ * pending_queued: Returns how many clients have sent their handshake and are waiting to be served.
+ */
+int pending_queued(void) {
+    int queued = 0;
+    for (int i = 0; i < PENDING_MAX; i++) {
+        if (pending_waiting(&pending[i]) && pending[i].queued.tv_sec != 0) queued++;
+    }
+    return queued;
+}
+
+/*
+ * pending_slot: Returns a free pending slot, or NULL if every slot is taken.
+ * wait_readable stops taking new clients while there is none, so they wait in the listen backlog and keep their order.
+ */
+struct session* pending_slot(void) {
+    for (int i = 0; i < PENDING_MAX; i++) {
+        if (pending[i].sock < 0) return &pending[i];
+    }
+    return NULL;
+}
+
+/*
+ * parse_class: Returns the priority class a handshake line asks for, removing the class from the line.
+ * The class is an optional last word after the user name, so anonymous clients and clients that name none are practice.
+ */
+int parse_class(char* line) {
+    char* last = strrchr(line, ' ');
+    if (last == NULL || last == strchr(line, ' ')) return CLASS_PRACTICE;
+    for (int c = 0; c < CLASSES; c++) {
+        if (strcmp(last + 1, class_names[c]) == 0) {
+            *last = '\0';
+            return c;
+        }
+    }
+    return CLASS_PRACTICE;
+}
+
+/*
+ * pending_admit: Accepts a client into a pending slot and sends it the preamble.
+ * This happens while another client may be in its quiz, so the newcomer can answer the preamble and be queued by class instead of waiting in the backlog unclassified. Admission limits apply here: under memory pressure the server gives back what it can rebuild and admits fewer clients, and clients beyond this second's limit are turned away.
+ */
+void pending_admit(void) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sock = accept(quiz_listen, (struct sockaddr*)&addr, &addr_len);
+    if (sock < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept");
+            rate_add(RATE_ERRORS);
+        }
+        return;
+    }
+
+    /* Under memory pressure, give back what can be rebuilt and admit fewer clients before the OOM killer ends the quiz in progress */
+    int rate_limit = accept_rate_limit;
+    int pressure = memory_pressure();
+    if (pressure) {
+        if (!under_pressure) {
+            printf("<Memory pressure: admitting %d client per second>\n", PRESSURE_RATE_LIMIT);
+            fflush(stdout);
+        }
+        shed_memory();
+        if (rate_limit == 0 || rate_limit > PRESSURE_RATE_LIMIT) rate_limit = PRESSURE_RATE_LIMIT;
+    }
+    under_pressure = pressure;
+
+    /* Turn clients away once this second's admission limit is reached, or when no slot can be had */
+    static const char busy[] = "Server busy, please try again later.\n";
+    struct session* s = NULL;
+    if (rate_limit > 0 && rate_this_second(RATE_ACCEPTED) >= (uint32_t)rate_limit) {
+        rate_add(RATE_REJECTED);
+    } else if ((s = pending_slot()) == NULL) {
+        rate_add(RATE_REJECTED);
+    }
+    if (s == NULL) {
+        send(sock, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(sock);
+        return;
+    }
+    rate_add(RATE_ACCEPTED);
+    unique_add(&unique_clients, addr.sin_addr.s_addr, (uint32_t)time(NULL));
+
+    s->sock = sock;
+    s->timed_out = 0;
+    s->input_start = s->input_end = 0;
+    memset(&s->out, 0, sizeof(s->out));
+    s->evicted = 0;
+    s->id = ++session_counter;
+    inet_ntop(AF_INET, &addr.sin_addr, s->peer, sizeof(s->peer));
+    s->user[0] = '\0';
+    s->phase = "welcome";
+    s->question = -1;
+    s->asked = s->score = 0;
+    s->started = time(NULL);
+    s->priority = CLASS_PRACTICE;
+    clock_gettime(CLOCK_MONOTONIC, &s->admitted);
+    s->queued.tv_sec = s->queued.tv_nsec = 0;
+
+    /* Every send is a complete message, so there is nothing for Nagle's algorithm to coalesce */
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    /* Output the client does not take at once is queued rather than blocking the server */
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    int zerocopy = 1;
+    s->out.zerocopy = setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)) == 0;
+
+    /* Send quiz preamble */
+    static const char preamble[] = "Welcome to Unix Programming Quiz!\n"
+                                   "The quiz comprises five questions posed to you one after the other.\n"
+                                   "You have only one attempt to answer a question.\n"
+                                   "Your final score will be sent to you after conclusion of the quiz.\n"
+                                   "To start the quiz, press Y and <enter>.\n"
+                                   "To review questions due for you, press R and <enter>.\n"
+                                   "To quit the quiz, press q and <enter>.\n";
+    struct iovec frame = { (void*)preamble, sizeof(preamble) - 1 };
+    send_frame(s, &frame, 1);
+}
+
+/*
+ * pending_read: Receives the handshake of a pending client into its input buffer, where serve_client later finds it.
+ * Once the line is complete the client is classified and queued; a client asking for exam priority gets it only if its user is on the exam roster. A practice client is turned away instead if PENDING_SHED clients are queued already or memory is under pressure, so exams keep their place when the server falls behind. Returns 1 if the client was queued, 0 otherwise.
+ */
+int pending_read(struct session* s) {
+    ssize_t n = recv(s->sock, s->input + s->input_end, sizeof(s->input) - s->input_end, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    if (n <= 0) {
+        rate_add(RATE_ERRORS);
+        pending_close(s, NULL);
+        return 0;
+    }
+    char* newline = memchr(s->input + s->input_end, '\n', n);
+    s->input_end += (int)n;
+    if (newline == NULL) {
+        if (s->input_end == (int)sizeof(s->input)) {
+            rate_add(RATE_ERRORS);
+            pending_close(s, NULL);
+        }
+        return 0;
+    }
+
+    /* Classify a copy, as serve_client parses the line again */
+    char line[MAX_LINES];
+    int len = (int)(newline - s->input);
+    if (len > MAX_LINES - 1) len = MAX_LINES - 1;
+    memcpy(line, s->input, len);
+    line[len] = '\0';
+    s->priority = parse_class(line);
+    char* space = strchr(line, ' ');
+    if (space != NULL && space[1] != '\0') snprintf(s->user, sizeof(s->user), "%s", space + 1);
+    /* Anyone can type "exam"; only users on the roster get its priority */
+    if (s->priority == CLASS_EXAM && !roster_has(s->user)) s->priority = CLASS_PRACTICE;
+    if (s->priority == CLASS_PRACTICE && (under_pressure || pending_queued() >= PENDING_SHED)) {
+        class_stats[CLASS_PRACTICE].shed++;
+        rate_add(RATE_REJECTED);
+        pending_close(s, "Server busy, practice is paused, please try again later.\n");
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &s->queued);
+    s->phase = "queued";
+    return 1;
+}
+
+/*
+ * pending_expire: Closes pending clients that have not completed their handshake within answer_timeout_sec.
+ * Returns the nanoseconds until the next of the others times out, or -1 if none is in its handshake.
+ */
+int64_t pending_expire(const struct timespec* now) {
+    int64_t left = -1;
+    for (int i = 0; i < PENDING_MAX; i++) {
+        struct session* s = &pending[i];
+        if (!pending_waiting(s) || s->queued.tv_sec != 0) continue;
+        struct timespec deadline = s->admitted;
+        deadline.tv_sec += answer_timeout_sec;
+        int64_t s_left = (int64_t)elapsed_ns(now, &deadline);
+        if (s_left <= 0) {
+            rate_add(RATE_ERRORS);
+            pending_close(s, NULL);
+        } else if (left < 0 || s_left < left) {
+            left = s_left;
+        }
+    }
+    return left;
+}
+
+/*
+ * pending_pick: Returns the queued client to serve next, or NULL if none is queued.
+ * Classes take turns by smooth weighted round-robin: every class with clients queued earns its weight in credit, the class with the most credit is served and pays back the weights of all of them. Exams thus get class_weights[CLASS_EXAM] turns for every practice turn, interleaved rather than in runs, while practice still moves when exams keep arriving. Within a class clients are served in the order they queued. The time the client waited is added to its class statistics.
+ */
+struct session* pending_pick(void) {
+    static int credit[CLASSES];
+    struct session* oldest[CLASSES] = { NULL };
+    for (int i = 0; i < PENDING_MAX; i++) {
+        struct session* s = &pending[i];
+        if (!pending_waiting(s) || s->queued.tv_sec == 0) continue;
+        if (oldest[s->priority] == NULL || (int64_t)elapsed_ns(&s->queued, &oldest[s->priority]->queued) > 0) {
+            oldest[s->priority] = s;
+        }
+    }
+
+    int total = 0;
+    int pick = -1;
+    for (int c = CLASSES - 1; c >= 0; c--) {
+        if (oldest[c] == NULL) {
+            credit[c] = 0;
+            continue;
+        }
+        credit[c] += class_weights[c];
+        total += class_weights[c];
+        if (pick < 0 || credit[c] > credit[pick]) pick = c;
+    }
+    if (pick < 0) return NULL;
+    credit[pick] -= total;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t wait = elapsed_ns(&oldest[pick]->queued, &now);
+    struct class_stats* st = &class_stats[pick];
+    st->served++;
+    st->wait_ns += wait;
+    if (wait > st->wait_max_ns) st->wait_max_ns = wait;
+    if (wait > load.lag_max_ns) load.lag_max_ns = wait;
+    return oldest[pick];
+}
+
+/*
+ * start_drain: Stops the server from taking new clients and gives the current session DRAIN_DEADLINE_SEC to finish.
+ * Clients still in their handshake or queued have not started a quiz, so they are told the server is shutting down and let go at once; a quiz in progress runs to its score unless the deadline passes first. Draining again while already draining ends the current session now.
+ */
+void start_drain(void) {
+    static const char notice[] = "Server shutting down, please try again later.\n";
+    clock_gettime(CLOCK_MONOTONIC, &drain_deadline);
+    if (!draining) drain_deadline.tv_sec += DRAIN_DEADLINE_SEC;
+    draining = 1;
+    for (int i = 0; i < PENDING_MAX; i++) {
+        if (pending_waiting(&pending[i])) pending_close(&pending[i], notice);
+    }
+}
+
+/*
+ * open_admin: Creates the admin listener on a Unix socket at the given path.
+ * A socket file left behind by a previous run is removed first. Access is governed by the permissions of the socket file, so the admin interface needs no authentication of its own.
+ */
+int open_admin(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: admin socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, ADMIN_MAX_CONNS) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    /* A client that gives up before it is accepted must not leave accept() blocking the loop */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    admin_listen = fd;
+    admin_path = path;
+    return 0;
+}
+
+/*
+ * admin_accept: Accepts a connection to the admin socket, refusing it if every slot is taken.
+ */
+void admin_accept(void) {
+    int fd = accept(admin_listen, NULL, NULL);
+    if (fd < 0) return;
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (admin_conns[i].fd < 0) {
+            /* Replies never wait for the admin client, so a stuck one cannot delay a quiz turn */
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            admin_conns[i].fd = fd;
+            admin_conns[i].len = 0;
+            return;
+        }
+    }
+    static const char busy[] = "ERR too many admin connections\n";
+    send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
+/*
+ * admin_close: Closes an admin connection and frees its slot.
+ */
+void admin_close(struct admin_conn* conn) {
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+/*
+ * admin_search: Prints the live questions matching a search query.
+ * The index is rebuilt the first time it is searched after a bank reload, so reloads themselves stay as cheap as before.
+ */
+void admin_search(FILE* out, const char* query) {
+    if (search_version != bank.version) {
+        index_free(&search_index);
+        if (index_build(&search_index, bank.questions, bank.count) < 0) {
+            fprintf(out, "ERR out of memory\n");
+            search_version = 0;
+            return;
+        }
+        search_version = bank.version;
+    }
+    int results[ADMIN_SEARCH_RESULTS];
+    int found = index_search(&search_index, bank.questions, query, results, ADMIN_SEARCH_RESULTS);
+    for (int i = 0; i < found; i++) {
+        fprintf(out, "%d%s %s\n", results[i], bank.retired[results[i]] ? " (retired)" : "", bank.questions[results[i]]);
+    }
+    fprintf(out, "OK %d matches\n", found);
+}
+
+/*
+ * admin_session: Returns the session with the given id, or NULL if it is neither being served nor pending.
+ */
+struct session* admin_session(const char* arg) {
+    if (arg == NULL) return NULL;
+    unsigned long id = strtoul(arg, NULL, 10);
+    if (current_session != NULL && current_session->id == id) return current_session;
+    for (int i = 0; i < PENDING_MAX; i++) {
+        if (pending_waiting(&pending[i]) && pending[i].id == id) return &pending[i];
+    }
+    return NULL;
+}
+
+/*
+ * admin_set: Changes a limit, or prints all of them when no name is given.
+ */
+void admin_set(FILE* out, const char* name, const char* value) {
+    if (name == NULL) {
+        fprintf(out, "timeout %d\nrate %d\nbacklog %d\nwatchdog %d\nOK\n", answer_timeout_sec, accept_rate_limit, listen_backlog, watchdog_ms);
+        return;
+    }
+    if (value == NULL) {
+        fprintf(out, "ERR missing value\n");
+        return;
+    }
+    int n = atoi(value);
+    if (strcmp(name, "timeout") == 0 && n > 0 && n <= 3600) {
+        answer_timeout_sec = n;
+    } else if (strcmp(name, "rate") == 0 && n >= 0) {
+        accept_rate_limit = n;
+    } else if (strcmp(name, "watchdog") == 0 && n > 0) {
+        watchdog_ms = n;
+    } else if (strcmp(name, "backlog") == 0 && n > 0 && n <= SOMAXCONN) {
+        /* Listening again on a listening socket only changes its backlog */
+        if (listen(quiz_listen, n) < 0) {
+            fprintf(out, "ERR listen: %s\n", strerror(errno));
+            return;
+        }
+        listen_backlog = n;
+    } else {
+        fprintf(out, "ERR bad limit\n");
+        return;
+    }
+    fprintf(out, "OK\n");
+}
+
+/*
+ * admin_command: Carries out one admin command, writing the reply to out.
+ * Every reply ends with a line starting with OK or ERR. No command does more than one pass over the question bank, so serving one never delays a quiz turn noticeably. Returns 1 if the main loop has to act on the command (a drain, or a reload done between clients), 0 otherwise.
+ */
+int admin_command(FILE* out, char* line) {
+    char* cmd = strtok(line, " \t\r");
+    char* arg = strtok(NULL, " \t\r");
+    struct session* s = admin_session(arg);
+
+    if (cmd == NULL) {
+        fprintf(out, "ERR empty command\n");
+    } else if (strcmp(cmd, "help") == 0) {
+        fprintf(out, "stats | sessions | session ID | kill ID | drain | reload | set [timeout|rate|backlog|watchdog N] | search QUERY\nOK\n");
+    } else if (strcmp(cmd, "stats") == 0) {
+        print_stats(out);
+        fprintf(out, "OK\n");
+    } else if (strcmp(cmd, "sessions") == 0) {
+        /* The session being served comes first, then the pending ones */
+        for (int i = -1; i < PENDING_MAX; i++) {
+            s = i < 0 ? current_session : &pending[i];
+            if (s == NULL || (i >= 0 && !pending_waiting(s))) continue;
+            fprintf(out, "%lu %s %s %s %s %d/%d\n", s->id, s->peer, s->user[0] ? s->user : "-", class_names[s->priority],
+                    s->phase, s->asked, QUIZ_LENGTH);
+        }
+        fprintf(out, "OK\n");
+    } else if (strcmp(cmd, "session") == 0) {
+        if (s == NULL) {
+            fprintf(out, "ERR no such session\n");
+        } else {
+            fprintf(out, "id %lu\npeer %s\nuser %s\nclass %s\nphase %s\nasked %d/%d\nscore %d\nage %lds\nbuffered %d\n",
+                    s->id, s->peer, s->user[0] ? s->user : "-", class_names[s->priority], s->phase, s->asked, QUIZ_LENGTH, s->score,
+                    (long)(time(NULL) - s->started), s->input_end - s->input_start);
+            if (s->question >= 0) fprintf(out, "question %d %.60s\n", s->question, bank.questions[s->question]);
+            fprintf(out, "OK\n");
+        }
+    } else if (strcmp(cmd, "kill") == 0) {
+        if (s == NULL) {
+            fprintf(out, "ERR no such session\n");
+        } else if (s != current_session) {
+            pending_close(s, NULL);
+            fprintf(out, "OK\n");
+        } else {
+            /* Queued output, attachments included, is dropped rather than flushed to a closed socket */
+            out_evict(s, "killed by admin");
+            fprintf(out, "OK\n");
+        }
+    } else if (strcmp(cmd, "drain") == 0) {
+        start_drain();
+        fprintf(out, "OK draining\n");
+        return 1;
+    } else if (strcmp(cmd, "reload") == 0) {
+        /* A session may hold question numbers the new version no longer has, so it keeps the bank it started with */
+        /* The roster is only read at handshakes, so it can change at once */
+        load_roster();
+        if (current_session != NULL) {
+            reload_requested = 1;
+            fprintf(out, "OK reload after session %lu\n", current_session->id);
+        } else if (load_bank() == 0) {
+            fprintf(out, "OK bank version %u: %d questions\n", bank.version, bank.count);
+            return 1;
+        } else {
+            fprintf(out, "ERR patch rejected\n");
+        }
+    } else if (strcmp(cmd, "set") == 0) {
+        admin_set(out, arg, strtok(NULL, " \t\r"));
+    } else if (strcmp(cmd, "search") == 0) {
+        /* strtok cut the query after its first word; put the rest back */
+        char* rest = strtok(NULL, "");
+        if (arg == NULL) {
+            fprintf(out, "ERR missing query\n");
+        } else {
+            if (rest != NULL) rest[-1] = ' ';
+            admin_search(out, arg);
+        }
+    } else {
+        fprintf(out, "ERR unknown command\n");
+    }
+    return 0;
+}
+
+/*
+ * admin_pending: Tells whether an admin connection has a complete command buffered.
+ */
+static inline int admin_pending(const struct admin_conn* conn) {
+    return conn->fd >= 0 && memchr(conn->buffer, '\n', conn->len) != NULL;
+}
+
+/*
+ * admin_read: Receives more command text on an admin connection, as much as its buffer has room for.
+ * A buffer still full of unanswered commands is left alone until some have been answered; a line that fills the buffer on its own is refused.
+ */
+void admin_read(struct admin_conn* conn) {
+    size_t room = sizeof(conn->buffer) - 1 - conn->len;
+    if (room == 0) return;
+    ssize_t n = recv(conn->fd, conn->buffer + conn->len, room, MSG_DONTWAIT);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) admin_close(conn);
+        return;
+    }
+    conn->len += (int)n;
+    if (conn->len == (int)sizeof(conn->buffer) - 1 && !admin_pending(conn)) {
+        static const char too_long[] = "ERR command too long\n";
+        send(conn->fd, too_long, sizeof(too_long) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        admin_close(conn);
+    }
+}
+
+/*
+ * admin_serve: Answers up to ADMIN_COMMAND_BUDGET of the commands buffered on an admin connection.
+ * Commands beyond the budget stay buffered until wait_readable's next round, after the other admin connections and the quiz have had their turn, so a client pasting a long script cannot hold everyone else up. Replies are composed in memory and sent in one go without waiting; a client whose socket buffer cannot take a whole reply has stopped reading and is disconnected. Returns 1 if the main loop has to act, as for admin_command.
+ */
+int admin_serve(struct admin_conn* conn) {
+    int wake = 0;
+    char* start = conn->buffer;
+    char* newline;
+    for (int budget = ADMIN_COMMAND_BUDGET; budget > 0 && conn->fd >= 0; budget--) {
+        newline = memchr(start, '\n', conn->buffer + conn->len - start);
+        if (newline == NULL) break;
+        *newline = '\0';
+        char* reply = NULL;
+        size_t reply_len = 0;
+        FILE* out = open_memstream(&reply, &reply_len);
+        if (out == NULL) {
+            admin_close(conn);
+            break;
+        }
+        wake |= admin_command(out, start);
+        fclose(out);
+        if (send(conn->fd, reply, reply_len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)reply_len) admin_close(conn);
+        free(reply);
+        start = newline + 1;
+    }
+    if (conn->fd < 0) return wake;
+
+    /* Keep unanswered commands and a partial one for later */
+    conn->len -= (int)(start - conn->buffer);
+    memmove(conn->buffer, start, conn->len);
+    return wake;
+}
+
+/*
+ * wait_readable: Waits until a socket is readable, serving the admin socket and sending the session's queued output in the meantime.
+ * This is the only place the server blocks, both between clients and during a quiz, so admin commands, SIGTERM/SIGINT (read from a signalfd) and new clients are acted on whatever the server is doing: newcomers are admitted, sent the preamble and queued by the class in their handshake. MSG_ZEROCOPY completions are collected as they arrive. A client that takes none of its queued output for OUT_STALL_SEC is evicted. With fd -1 the wait is for the session's output alone to be sent and completed, or without a session for a client to be queued. A NULL deadline waits indefinitely. Returns 1 when the socket is readable (or the output sent, or the client evicted, or a client queued), 0 when the deadline passed, or -1 when a signal arrived or an admin command needs the main loop.
+ */
+int wait_readable(int fd, struct session* session, const struct timespec* deadline) {
+    for (;;) {
+        struct pollfd fds[5 + ADMIN_MAX_CONNS + PENDING_MAX];
+        struct admin_conn* conns[5 + ADMIN_MAX_CONNS + PENDING_MAX];
+        struct session* clients[5 + ADMIN_MAX_CONNS + PENDING_MAX];
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t handshake_left = pending_expire(&now);
+        int n = 0;
+        fds[n].fd = fd;
+        fds[n++].events = POLLIN;
+        int out = -1;
+        if (session != NULL && (session->out.count > 0 || session->out.zerocopy_pending > 0)) {
+            /* Completions arrive as POLLERR, which poll() reports whatever the events asked for */
+            out = n;
+            fds[n].fd = session->sock;
+            fds[n++].events = session->out.count > 0 ? POLLOUT : 0;
+        }
+        if (signal_fd >= 0) {
+            fds[n].fd = signal_fd;
+            fds[n++].events = POLLIN;
+        }
+        if (admin_listen >= 0) {
+            fds[n].fd = admin_listen;
+            fds[n++].events = POLLIN;
+        }
+        /* Clients left in the backlog when no slot can be had are still taken in order later */
+        if (!draining && pending_slot() != NULL) {
+            fds[n].fd = quiz_listen;
+            fds[n++].events = POLLIN;
+        }
+        for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+            if (admin_conns[i].fd < 0) continue;
+            conns[n] = &admin_conns[i];
+            fds[n].fd = admin_conns[i].fd;
+            fds[n++].events = POLLIN;
+        }
+        /* Pending clients are read until their handshake is in, and sent the preamble if it did not go out at once */
+        for (int i = 0; i < PENDING_MAX; i++) {
+            struct session* s = &pending[i];
+            if (!pending_waiting(s)) continue;
+            short events = (s->queued.tv_sec == 0 ? POLLIN : 0) | (s->out.count > 0 ? POLLOUT : 0);
+            if (events == 0) continue;
+            conns[n] = NULL;
+            clients[n] = s;
+            fds[n].fd = s->sock;
+            fds[n++].events = events;
+        }
+
+        int64_t left = -1;
+        if (deadline != NULL) {
+            left = (int64_t)elapsed_ns(&now, deadline);
+            if (left <= 0) return 0;
+        }
+        if (out >= 0 && session->out.stalled_since.tv_sec != 0) {
+            struct timespec stall_deadline = session->out.stalled_since;
+            stall_deadline.tv_sec += OUT_STALL_SEC;
+            int64_t stall_left = (int64_t)elapsed_ns(&now, &stall_deadline);
+            if (stall_left <= 0) {
+                out_evict(session, "stopped reading");
+                return 1;
+            }
+            if (left < 0 || stall_left < left) left = stall_left;
+        }
+        if (handshake_left >= 0 && (left < 0 || handshake_left < left)) left = handshake_left;
+        int timeout_ms = left < 0 ? -1 : (int)((left + 999999) / 1000000);
+
+        /* Commands left over from the last round are answered without waiting */
+        for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+            if (admin_pending(&admin_conns[i])) timeout_ms = 0;
+        }
+
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        watch_idle(&before);
+        int ready = poll(fds, n, timeout_ms);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        watch_busy(&after);
+        load.idle_ns += elapsed_ns(&before, &after);
+        load_tick();
+        if (ready < 0) {
+            if (errno == EINTR) return -1;
+            perror("poll");
+            return -1;
+        }
+
+        if (out >= 0 && (fds[out].revents & POLLERR) && session->out.zerocopy_pending > 0 && zerocopy_reap(session)) {
+            fds[out].revents &= ~POLLERR;
+            fds[0].revents &= ~POLLERR;
+        }
+        if (out >= 0 && fds[out].revents != 0) out_flush(session);
+        if (out >= 0 && fd < 0 && session->out.count == 0 && session->out.zerocopy_pending == 0) return 1;
+        int wake = 0;
+        int admit = 0;
+        int queued = 0;
+        for (int i = 1; i < n; i++) {
+            if (fds[i].revents == 0 || i == out) continue;
+            if (fds[i].fd == signal_fd) {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                    start_drain();
+                    wake = 1;
+                }
+            } else if (fds[i].fd == quiz_listen) {
+                admit = 1;
+            } else if (fds[i].fd == admin_listen) {
+                admin_accept();
+            } else if (conns[i] != NULL) {
+                admin_read(conns[i]);
+            } else if (clients[i]->sock == fds[i].fd) {
+                /* A drain may have closed the client already, earlier in this loop */
+                struct session* s = clients[i];
+                if ((fds[i].revents & POLLOUT) && out_flush(s) < 0) pending_close(s, NULL);
+                else if (s->queued.tv_sec == 0 && (fds[i].revents & ~POLLOUT)) queued |= pending_read(s);
+            }
+        }
+        /* Admitted last, so a newcomer cannot reuse the descriptor of a client closed above */
+        if (admit && !draining) pending_admit();
+
+        /* Answer buffered commands round-robin, starting with a different connection each round */
+        static int admin_next;
+        for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+            struct admin_conn* conn = &admin_conns[(admin_next + i) % ADMIN_MAX_CONNS];
+            if (admin_pending(conn)) wake |= admin_serve(conn);
+        }
+        admin_next = (admin_next + 1) % ADMIN_MAX_CONNS;
+        if (fds[0].revents != 0) return 1;
+        if (wake) return -1;
+        if (fd < 0 && session == NULL && queued) return 1;
+    }
+}
+
+/*
+ * transport_recv: Receives bytes from a client connection.
+ * The session code reaches the socket only through transport_recv and send_frame. These are plain functions the compiler can inline, so the quiz path makes direct system calls with no function pointers or runtime checks of the connection type.
+ */
+static inline ssize_t transport_recv(struct session* session, void* buffer, size_t len) {
+    /* Do not let a silent client hold the server forever */
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += answer_timeout_sec;
+    for (;;) {
+        /* A drain cuts the wait short at its deadline */
+        const struct timespec* limit = &deadline;
+        if (draining && (int64_t)elapsed_ns(&drain_deadline, &deadline) > 0) limit = &drain_deadline;
+        int ready = wait_readable(session->sock, session, limit);
+        if (ready == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        /* Signals and admin commands only set flags for the main loop, so keep waiting after one */
+        if (ready < 0) continue;
+        ssize_t n = recv(session->sock, buffer, len, 0);
+        if (n >= 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+    }
+}
+
+/*
+ * out_finish: Sends what is left of the session's output before its connection is closed, and waits until the kernel is done with any memory lent to it by MSG_ZEROCOPY.
+ * A client that takes none of it for OUT_STALL_SEC is evicted instead of holding up the next one.
+ */
+void out_finish(struct session* session) {
+    while (!session->evicted && (out_flush(session) > 0 || session->out.zerocopy_pending > 0)) {
+        if (session->out.count == 0 && session->out.stalled_since.tv_sec == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &session->out.stalled_since);
+        }
+        wait_readable(-1, session, NULL);
+    }
+}
 
 /*
- * read_line: Reads a line from a socket until a newline character, storing it in a buffer.
- * This function receives data one byte at a time from the specified socket, building a string until it encounters a newline or reaches the buffer's maximum length. It excludes the newline from the buffer, null-terminates the string, and returns the number of bytes read or -1 on error.
+ * read_line: Reads a line from a client session until a newline character, storing it in a buffer.
+ * This function takes the line from the session's input buffer, receiving more from the socket only when no complete line is buffered. One recv() typically brings in a whole line (or several, if the client sends ahead), instead of one system call per byte. It excludes the newline from the buffer, null-terminates the string, and returns the number of bytes read or -1 on error. If the client stayed silent past the receive timeout, timed_out is set in the session as well. A line longer than the buffer is returned in pieces.
  */
-int read_line(int sock, char* buffer, int max_len) {
+int read_line(struct session* session, char* buffer, int max_len) {
     int i = 0;
-    char c;
     while (i < max_len - 1) {
-        /* Receive one byte from socket */
-        int n = recv(sock, &c, 1, 0);
-        /* Return -1 if connection closed or error occurs */
-        if (n <= 0) return -1;
+        /* Refill the input buffer once it has been consumed */
+        if (session->input_start == session->input_end) {
+            ssize_t n = transport_recv(session, session->input, sizeof(session->input));
+            /* Return -1 if connection closed or error occurs */
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) session->timed_out = 1;
+                return -1;
+            }
+            session->input_start = 0;
+            session->input_end = (int)n;
+        }
+        char c = session->input[session->input_start++];
         /* Stop at newline, null-terminate buffer */
         if (c == '\n') {
             buffer[i] = '\0';
@@ -54,33 +2343,161 @@ int read_line(int sock, char* buffer, int max_len) {
 }
 
 /*
- * send_message: Sends a message followed by a newline to a socket.
- * This function transmits a given string to the specified socket and appends a newline character to ensure proper line-based communication. It uses the send() system call to handle the transmission, making it suitable for sending questions, feedback, and score messages to the client.
+ * serve_client: Runs one client through the quiz, from its handshake to the final score.
+ * The preamble went out when the client was admitted and its handshake is already buffered. This function reads the client's choice, optional user name and priority class, selects the questions, asks them one by one with feedback, and sends the score. It returns early if the client quits, sends anything unexpected or disconnects; the caller closes the connection.
  */
-void send_message(int sock, const char* message) {
-    /* Send the message content */
-    send(sock, message, strlen(message), 0);
-    /* Append newline for line-based protocol */
-    send(sock, "\n", 1, 0);
+void serve_client(struct session* session) {
+    /* Read client's response (Y or q, optionally followed by a user name and a class) */
+    char response[MAX_LINES];
+    if (read_line(session, response, sizeof(response)) <= 0) {
+        /* Give up on read error */
+        rate_add(RATE_ERRORS);
+        return;
+    }
+    parse_class(response);
+
+    /* Split off the user name identifying a returning student */
+    const char* user = NULL;
+    char* space = strchr(response, ' ');
+    if (space != NULL) {
+        *space = '\0';
+        if (space[1] != '\0') user = space + 1;
+    }
+    if (user != NULL) {
+        unique_add(&unique_users, hash_user(user), (uint32_t)time(NULL));
+        snprintf(session->user, sizeof(session->user), "%s", user);
+    }
+
+    /* Check if client wants to quit */
+    if (strcmp(response, "q") == 0) {
+        return;
+    }
+    /* Validate response is Y, or R from an identified user */
+    int review = strcmp(response, "R") == 0 && user != NULL;
+    if (strcmp(response, "Y") != 0 && !review) {
+        return;
+    }
+
+    /* Take a precomputed plan and pick five questions this user has not seen recently */
+    struct quiz_plan plan;
+    int selected[QUIZ_LENGTH];
+    pop_plan(&plan);
+    struct user_history* history = user != NULL ? find_history(user) : NULL;
+    choose_questions(&plan, review ? NULL : history, selected);
+
+    /* In review mode, due questions come first and the plan fills any remaining places */
+    uint32_t now = (uint32_t)time(NULL);
+    struct schedule_record* record = user != NULL ? find_schedule(user) : NULL;
+    if (review) {
+        int chosen[QUIZ_LENGTH];
+        memcpy(chosen, selected, sizeof(chosen));
+        int count = schedule_due(record, now, selected, QUIZ_LENGTH);
+        for (int i = 0; i < QUIZ_LENGTH && count < QUIZ_LENGTH; i++) {
+            int duplicate = 0;
+            for (int j = 0; j < count; j++) {
+                if (selected[j] == chosen[i]) duplicate = 1;
+            }
+            if (!duplicate) selected[count++] = chosen[i];
+        }
+    }
+
+    /* Record what is actually asked, due questions included */
+    if (history != NULL) {
+        for (int i = 0; i < QUIZ_LENGTH; i++) {
+            history_add(history, selected[i]);
+        }
+    }
+    session->phase = review ? "review" : "quiz";
+
+    /* Conduct quiz for client */
+    int score = 0;
+    int asked_count;
+    for (asked_count = 0; asked_count < QUIZ_LENGTH; asked_count++) {
+        int q_idx = selected[asked_count];
+        /* Send question to client */
+        struct turn turn;
+        struct timespec asked, answered;
+        session->question = q_idx;
+        ask_question(session, q_idx, &turn);
+        clock_gettime(CLOCK_MONOTONIC, &asked);
+        question_stats[q_idx].asked++;
+
+        /* Read client's answer */
+        char answer[MAX_LINES];
+        if (read_line(session, answer, sizeof(answer)) <= 0) {
+            /* Break loop on read error */
+            if (session->timed_out) question_stats[q_idx].timed_out++;
+            rate_add(RATE_ERRORS);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &answered);
+
+        /* Evaluate answer, count it and reschedule the question for identified users */
+        int correct = grade_answer(answer, q_idx, &turn);
+        question_stats[q_idx].think_ns += elapsed_ns(&asked, &answered);
+        if (correct) question_stats[q_idx].correct++;
+        else question_stats[q_idx].wrong++;
+        rate_add(correct ? RATE_CORRECT : RATE_WRONG);
+        if (record != NULL) schedule_update(record, q_idx, correct, now);
+        session->asked = asked_count + 1;
+        if (correct) {
+            score++;
+            session->score = score;
+            /* Send positive feedback */
+            send_message(session, "Right Answer.");
+        } else {
+            /* Send negative feedback */
+            send_wrong_feedback(session, q_idx, &turn);
+        }
+    }
+
+    /* Send final score to client */
+    char score_message[256];
+    int len = snprintf(score_message, sizeof(score_message), "Your quiz score is %d/%d. Goodbye!\n", score, QUIZ_LENGTH);
+    send_copy(session, score_message, (size_t)len);
+    if (asked_count == QUIZ_LENGTH) rate_add(RATE_COMPLETED);
+
+    /* Batch schedule updates to disk */
+    if (record != NULL) schedule_flush();
 }
 
 /*
- * main: Implements the TCP quiz server logic.
- * This function sets up a TCP server that binds to a user-specified IP address and port, listens for client connections, and handles the quiz process for each client iteratively. It sends a welcome message, processes the client's response ('Y' to start or 'q' to quit), selects five random questions, conducts the quiz by sending questions and evaluating answers, and sends the final score. Error handling is implemented for all socket operations.
+ * inherited_listener: Returns the listening socket passed in by a service manager, or -1 if there is none.
+ * This follows the LISTEN_FDS protocol of systemd socket activation: the first passed socket is descriptor 3, and LISTEN_PID names the process it is meant for, so a process that merely inherited the environment leaves it alone. The manager keeps the port open while the server restarts, so clients arriving in between wait in the backlog instead of being refused.
  */
-int main(int argc, char** argv) {
-    /* Validate command-line arguments */
-    if (argc != 3) {
-        fprintf(stderr, "Error - Incorrect number of arguments. Use as follows: %s <IP> <port>\n", argv[0]);
+int inherited_listener(void) {
+    const char* pid = getenv("LISTEN_PID");
+    const char* fds = getenv("LISTEN_FDS");
+    if (pid == NULL || fds == NULL || atol(pid) != (long)getpid() || atoi(fds) < 1) return -1;
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (getsockopt(3, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening) {
+        fprintf(stderr, "LISTEN_FDS: descriptor 3 is not a listening socket\n");
+        exit(EXIT_FAILURE);
+    }
+    /* Client addresses are handled as IPv4 throughout, so an IPv6 socket (systemd's default for a bare port) is refused */
+    int family = 0;
+    len = sizeof(family);
+    if (getsockopt(3, SOL_SOCKET, SO_DOMAIN, &family, &len) < 0 || family != AF_INET) {
+        fprintf(stderr, "LISTEN_FDS: descriptor 3 is not an IPv4 socket; listen on an IPv4 address such as 0.0.0.0:PORT\n");
         exit(EXIT_FAILURE);
     }
+    fcntl(3, F_SETFD, FD_CLOEXEC);
+    /* Another instance sharing the socket may take a client first, so accept() must not block */
+    fcntl(3, F_SETFL, fcntl(3, F_GETFL) | O_NONBLOCK);
+    return 3;
+}
 
-    char* ip = argv[1];
-    /* Convert port string to integer */
-    int port = atoi(argv[2]);
-    int server_sock, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len;
+/*
+ * open_listener: Creates the TCP socket the quiz is served on, bound to the given address and listening.
+ */
+int open_listener(const char* ip, int port) {
+    int server_sock;
+    struct sockaddr_in server_addr;
 
     /* Create TCP socket */
     server_sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -106,112 +2523,206 @@ int main(int argc, char** argv) {
     }
 
     /* Listen for incoming connections */
-    if (listen(server_sock, 5) < 0) {
+    if (listen(server_sock, listen_backlog) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    /* Print listening status */
-    printf("<Listening on %s:%d>\n", ip, port);
-    printf("<Press ctrl-C to terminate>\n");
-
-    /* Main loop to handle clients */
-    while (1) {
-        client_len = sizeof(client_addr);
-        /* Accept client connection */
-        client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
-        if (client_sock < 0) {
-            perror("accept");
-            continue;
-        }
+    /* Clients are accepted from the poll loop, which must never block in accept() */
+    fcntl(server_sock, F_SETFL, fcntl(server_sock, F_GETFL) | O_NONBLOCK);
+    return server_sock;
+}
 
-        /* Send quiz preamble */
-        const char* preamble = "Welcome to Unix Programming Quiz!\n"
-                               "The quiz comprises five questions posed to you one after the other.\n"
-                               "You have only one attempt to answer a question.\n"
-                               "Your final score will be sent to you after conclusion of the quiz.\n"
-                               "To start the quiz, press Y and <enter>.\n"
-                               "To quit the quiz, press q and <enter>.\n";
-        send(client_sock, preamble, strlen(preamble), 0);
-
-        /* Read client's response (Y or q) */
-        char response[MAX_LINES];
-        if (read_line(client_sock, response, sizeof(response)) <= 0) {
-            /* Close connection on read error */
-            close(client_sock);
-            continue;
-        }
+/*
+ * main: Implements the TCP quiz server logic.
+ * This function sets up a TCP server that binds to a user-specified IP address and port, listens for client connections, and handles the quiz process for one client at a time by passing it to serve_client(); clients arriving meanwhile are queued by priority class and taken by pending_pick(). Between clients it applies requested bank reloads and tops up the plan queue. Error handling is implemented for all socket operations.
+ */
+int main(int argc, char** argv) {
+    struct timespec started, ready;
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
-        /* Check if client wants to quit */
-        if (strcmp(response, "q") == 0) {
-            close(client_sock);
-            continue;
-        }
-        /* Validate response is Y */
-        if (strcmp(response, "Y") != 0) {
-            close(client_sock);
-            continue;
+    /* Parse options */
+    const char* schedule_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:a:e:")) != -1) {
+        switch (opt) {
+        case 'a':
+            admin_path = optarg;
+            break;
+        case 'e':
+            roster_path = optarg;
+            break;
+        case 's':
+            schedule_path = optarg;
+            break;
+        case 'p':
+            patch_path = optarg;
+            break;
+        default:
+            exit(EXIT_FAILURE);
         }
+    }
 
-        /* Calculate number of available questions */
-        int num_questions = sizeof(QuizQ) / sizeof(QuizQ[0]);
-        int selected[5];
-        int count = 0;
-        /* Seed random number generator */
-        srand(time(NULL));
-        /* Select five unique question indices */
-        while (count < 5) {
-            int idx = rand() % num_questions;
-            int found = 0;
-            for (int i = 0; i < count; i++) {
-                if (selected[i] == idx) {
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found) {
-                selected[count] = idx;
-                count++;
-            }
+    int server_sock;
+    struct sockaddr_in server_addr;
+    socklen_t addr_len;
+
+    /* Fit the history table and backlog to the cgroup's limits */
+    size_for_cgroup();
+    histories = aligned_alloc(64, history_slots * sizeof(struct user_history));
+    if (histories == NULL) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    /* Clearing the table also faults it in, so early clients do not pay for that either */
+    memset(histories, 0, history_slots * sizeof(struct user_history));
+
+    /* Take over a listening socket from a service manager, or bind one */
+    server_sock = inherited_listener();
+    if (server_sock < 0) {
+        /* Validate command-line arguments */
+        if (argc - optind != 2) {
+            fprintf(stderr, "Error - Incorrect number of arguments. Use as follows: %s [-s schedule file] [-p patch file] [-a admin socket] [-e exam roster] <IP> <port>\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
+        server_sock = open_listener(argv[optind], atoi(argv[optind + 1]));
+    }
 
-        /* Conduct quiz for client */
-        int score = 0;
-        char feedback[256];
-        for (int i = 0; i < 5; i++) {
-            int q_idx = selected[i];
-            /* Send question to client */
-            send_message(client_sock, QuizQ[q_idx]);
+    quiz_listen = server_sock;
+    for (int i = 0; i < PENDING_MAX; i++) {
+        pending[i].sock = -1;
+    }
 
-            /* Read client's answer */
-            char answer[MAX_LINES];
-            if (read_line(client_sock, answer, sizeof(answer)) <= 0) {
-                /* Break loop on read error */
-                break;
-            }
+    /* Open the admin socket */
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        admin_conns[i].fd = -1;
+    }
+    if (admin_path != NULL && open_admin(admin_path) < 0) {
+        exit(EXIT_FAILURE);
+    }
 
-            /* Evaluate answer */
-            if (strcmp(answer, QuizA[q_idx]) == 0) {
-                score++;
-                /* Send positive feedback */
-                send_message(client_sock, "Right Answer.");
-            } else {
-                /* Prepare and send negative feedback */
-                snprintf(feedback, sizeof(feedback), "Wrong Answer. Right answer is %s.", QuizA[q_idx]);
-                send_message(client_sock, feedback);
+    /* Print listening status */
+    addr_len = sizeof(server_addr);
+    getsockname(server_sock, (struct sockaddr*)&server_addr, &addr_len);
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server_addr.sin_addr, ip, sizeof(ip));
+    printf("<Listening on %s:%d>\n", ip, ntohs(server_addr.sin_port));
+    printf("<Press ctrl-C to stop once the current quiz ends>\n");
+
+    /* Map the spaced-repetition store */
+    open_schedule(schedule_path);
+
+    /* Build the question bank, which also finds near-duplicate questions */
+    if (load_bank() < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Read the users allowed to ask for exam priority */
+    if (load_roster() < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Reload the patch on SIGHUP and print statistics on SIGUSR1; no SA_RESTART so a waiting poll() returns to act on them */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_reload;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGHUP, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    /* sendfile() cannot take MSG_NOSIGNAL, so a client gone mid-attachment would otherwise kill the server */
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    sa.sa_handler = handle_stats;
+    if (sigaction(SIGUSR1, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Report stalls of the loop; SA_RESTART resumes the blocking call the watchdog interrupted. Loading backtrace() now keeps the handler from doing it */
+    void* frame;
+    backtrace(&frame, 1);
+    sa.sa_handler = handle_stall;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGALRM, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Drain on SIGTERM and SIGINT; they are blocked and read from a signalfd in the wait loop, so they never interrupt a quiz turn */
+    sigset_t drain_signals;
+    sigemptyset(&drain_signals);
+    sigaddset(&drain_signals, SIGTERM);
+    sigaddset(&drain_signals, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &drain_signals, NULL) < 0 || (signal_fd = signalfd(-1, &drain_signals, SFD_CLOEXEC)) < 0) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Seed random number generator once for the lifetime of the server */
+    rng_seed((uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32));
+
+    /* Prewarm before the first accept: queue the first plans so early clients do not wait for them */
+    fill_plan_queue();
+    clock_gettime(CLOCK_MONOTONIC, &ready);
+    printf("<Ready in %.1f ms>\n", elapsed_ns(&started, &ready) / 1e6);
+    fflush(stdout);
+
+    /* Main loop to handle clients, until the server is drained */
+    while (!draining) {
+        /* Apply a patch and roster reload requested while the previous client was served */
+        if (reload_requested) {
+            reload_requested = 0;
+            load_roster();
+            if (load_bank() == 0) {
+                printf("<Bank version %u: %d questions>\n", bank.version, bank.count);
+                fflush(stdout);
             }
         }
 
-        /* Send final score to client */
-        char score_message[256];
-        snprintf(score_message, sizeof(score_message), "Your quiz score is %d/5. Goodbye!", score);
-        send_message(client_sock, score_message);
+        /* Print statistics requested while the previous client was served */
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats(stdout);
+        }
+
+        /* Precompute quiz plans before blocking on the next client */
+        fill_plan_queue();
+
+        /* Take the next queued client by class, admitting new ones and answering admin commands meanwhile */
+        struct session* session = pending_pick();
+        if (session == NULL) {
+            wait_readable(-1, NULL, NULL);
+            continue;
+        }
 
-        /* Close client connection */
-        close(client_sock);
+        /* Serve the quiz, then close client connection */
+        clock_gettime(CLOCK_MONOTONIC, &load.session_mark);
+        current_session = session;
+        serve_client(session);
+        out_finish(session);
+        current_session = NULL;
+        load_tick();
+        load.session_mark.tv_sec = 0;
+        close(session->sock);
+        session->sock = -1;
     }
 
-    /* Close server socket (unreachable due to infinite loop) */
+    /* Drained: stop taking connections, write back review state and release the sockets */
     close(server_sock);
+    if (schedule != NULL) msync(schedule, sizeof(struct schedule_store), MS_SYNC);
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (admin_conns[i].fd >= 0) admin_close(&admin_conns[i]);
+    }
+    if (admin_listen >= 0) {
+        close(admin_listen);
+        unlink(admin_path);
+    }
+    close(signal_fd);
+    printf("<Drained>\n");
     return 0;
 }
\ No newline at end of file